@@ -250,8 +250,9 @@ void boot2_init(void) {
 		}
 	}
 
-	// boot2 content flush would flush entire cache anyway so just do it all
-	dc_flushall();
+	// only what read_to() filled; dc_flushrange cleans the whole cache
+	// instead when that is more than the cache holds
+	dc_flushrange(boot2, page_ptr - boot2);
 	boot2_initialized = 1;
 }
 
@@ -0,0 +1,190 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	PPC boot payload cache
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "types.h"
+#include "string.h"
+#include "ff.h"
+#include "diskio.h"
+#include "elf.h"
+#include "gecko.h"
+#include "bootcache.h"
+
+#define SECTOR_SIZE 512
+
+static u8 sector[SECTOR_SIZE] MEM2_BSS ALIGNED(32);
+
+// Fletcher-32 over bytes; it only has to catch a stale or torn sidecar
+static u32 _checksum(const void *data, u32 len)
+{
+	const u8 *p = data;
+	u32 a = 1, b = 0;
+
+	while (len--) {
+		a = (a + *p++) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+// FatFs only ever uses drive 0 here
+static int _read_sector(u32 sect)
+{
+	return disk_read(0, sector, sect, 1) == RES_OK ? 0 : -1;
+}
+
+// The validity checks have to see what is on the card, not what the sector
+// cache still remembers from before the PPC or a card swap changed it.
+static int _read_sector_uncached(u32 sect)
+{
+	DWORD range[2] = { sect, 1 };
+
+	// fails harmlessly when there is no cache to drop
+	disk_ioctl(0, CTRL_FORGET, range);
+	return _read_sector(sect);
+}
+
+// Fills bc from the sidecar and returns 0 if it describes path as it is on
+// the card right now. Costs the sidecar lookup and two sector reads.
+int bootcache_lookup(bootcache *bc, const char *path)
+{
+	FIL fd;
+	FRESULT fres;
+	u32 read;
+
+	if (f_open(&fd, BOOTCACHE_FILE, FA_READ) != FR_OK)
+		return -1;
+	fres = f_read(&fd, bc, sizeof(*bc), &read);
+	f_close(&fd);
+	if (fres != FR_OK || read != sizeof(*bc))
+		return -1;
+
+	if (bc->magic != BOOTCACHE_MAGIC || bc->version != BOOTCACHE_VERSION)
+		return -1;
+	if (bc->checksum != _checksum(bc, (u8 *)&bc->checksum - (u8 *)bc))
+		return -1;
+	if (strncmp(bc->path, path, sizeof(bc->path)))
+		return -1;
+	if (!bc->nextents || bc->ehdr.e_phnum > BOOTCACHE_PHDRS)
+		return -1;
+
+	if (_read_sector_uncached(bc->dir_sect) || bc->dir_off > SECTOR_SIZE - 32 ||
+			memcmp(&sector[bc->dir_off], bc->dirent, 32))
+		return -1;
+	if (_read_sector_uncached(bc->extents[0].sector) ||
+			bc->hdrsum != _checksum(sector, SECTOR_SIZE))
+		return -1;
+
+	return 0;
+}
+
+// Describes the payload fd was opened on. linkmap is its cluster map from
+// f_lseek(fd, CREATE_LINKMAP).
+int bootcache_record(bootcache *bc, const char *path, FIL *fd,
+					const DWORD *linkmap, const Elf32_Ehdr *ehdr,
+					const Elf32_Phdr *phdrs)
+{
+	FATFS *fs = fd->fs;
+	u32 i, n, prev = 0;
+
+	if (!linkmap || ehdr->e_phnum > BOOTCACHE_PHDRS ||
+			(u32)strlen(path) >= sizeof(bc->path))
+		return -1;
+
+	memset(bc, 0, sizeof(*bc));
+	bc->magic = BOOTCACHE_MAGIC;
+	bc->version = BOOTCACHE_VERSION;
+	strlcpy(bc->path, path, sizeof(bc->path));
+
+	// fragments are stored as (running cluster count, first cluster) pairs
+	for (i = 1, n = 0; linkmap[i]; i += 2, n++) {
+		if (n == BOOTCACHE_EXTENTS)
+			return -1;
+		bc->extents[n].sector = (linkmap[i+1] - 2) * fs->csize + fs->database;
+		bc->extents[n].count = (linkmap[i] - prev) * fs->csize;
+		prev = linkmap[i];
+	}
+	if (!n)
+		return -1;
+	bc->nextents = n;
+
+	bc->dir_sect = fd->dir_sect;
+	bc->dir_off = fd->dir_ptr - fs->win;
+	if (bc->dir_off > SECTOR_SIZE - 32 || _read_sector(bc->dir_sect))
+		return -1;
+	memcpy(bc->dirent, &sector[bc->dir_off], 32);
+
+	if (_read_sector(bc->extents[0].sector))
+		return -1;
+	bc->hdrsum = _checksum(sector, SECTOR_SIZE);
+
+	memcpy(&bc->ehdr, ehdr, sizeof(bc->ehdr));
+	memcpy(bc->phdrs, phdrs, ehdr->e_phnum * sizeof(Elf32_Phdr));
+	bc->checksum = _checksum(bc, (u8 *)&bc->checksum - (u8 *)bc);
+	return 0;
+}
+
+int bootcache_save(const bootcache *bc)
+{
+	FIL fd;
+	FRESULT fres;
+	u32 written;
+
+	fres = f_open(&fd, BOOTCACHE_FILE, FA_CREATE_ALWAYS|FA_WRITE);
+	if (fres != FR_OK)
+		return -fres;
+	fres = f_write(&fd, bc, sizeof(*bc), &written);
+	f_close(&fd);
+	if (fres != FR_OK)
+		return -fres;
+	return written == sizeof(*bc) ? 0 : -1;
+}
+
+// Reads len bytes at pos of the payload straight off the card. Whole
+// sectors go directly to dst in as few transfers as the extents allow.
+int bootcache_read(const bootcache *bc, u32 pos, void *dst, u32 len)
+{
+	u8 *out = dst;
+	u32 i, base, n, off, sect, left;
+
+	while (len) {
+		base = 0;
+		for (i = 0; i < bc->nextents; i++) {
+			if (pos < base + bc->extents[i].count * SECTOR_SIZE)
+				break;
+			base += bc->extents[i].count * SECTOR_SIZE;
+		}
+		if (i == bc->nextents)
+			return -FR_INT_ERR;
+
+		sect = bc->extents[i].sector + (pos - base) / SECTOR_SIZE;
+		off = pos % SECTOR_SIZE;
+		left = bc->extents[i].count - (pos - base) / SECTOR_SIZE;
+
+		if (off || len < SECTOR_SIZE) {
+			if (_read_sector(sect))
+				return -FR_DISK_ERR;
+			n = SECTOR_SIZE - off;
+			if (n > len)
+				n = len;
+			memcpy(out, &sector[off], n);
+		} else {
+			n = len / SECTOR_SIZE;
+			if (n > left)
+				n = left;
+			if (disk_read(0, out, sect, n) != RES_OK)
+				return -FR_DISK_ERR;
+			n *= SECTOR_SIZE;
+		}
+
+		pos += n;
+		out += n;
+		len -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	PPC boot payload cache
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __BOOTCACHE_H__
+#define __BOOTCACHE_H__
+
+#include "types.h"
+#include "ff.h"
+#include "elf.h"
+
+#define BOOTCACHE_FILE		"/bootmii/bootcach.bin"
+#define BOOTCACHE_MAGIC		0x42434348 // "BCCH"
+#define BOOTCACHE_VERSION	1
+
+#define BOOTCACHE_PHDRS		10
+#define BOOTCACHE_EXTENTS	32
+#define BOOTCACHE_PATH		64
+
+// a run of consecutive sectors of the payload file
+typedef struct {
+	u32 sector;
+	u32 count;
+} bootcache_extent;
+
+// Everything needed to load a raw ELF payload again without going through
+// FatFs: its headers and where its data sits on the card. A hit needs the
+// directory entry and the first sector of the file to be unchanged.
+typedef struct {
+	u32 magic;
+	u32 version;
+	char path[BOOTCACHE_PATH];
+	u32 dir_sect;		// sector holding the payload's directory entry
+	u32 dir_off;		// and its offset in there
+	u8 dirent[32];		// name, attributes, times, start cluster, size
+	u32 hdrsum;			// checksum of the first sector of the payload
+	Elf32_Ehdr ehdr;
+	Elf32_Phdr phdrs[BOOTCACHE_PHDRS];
+	u32 nextents;
+	bootcache_extent extents[BOOTCACHE_EXTENTS];
+	u32 checksum;		// of everything above
+} bootcache;
+
+int bootcache_lookup(bootcache *bc, const char *path);
+int bootcache_record(bootcache *bc, const char *path, FIL *fd,
+					const DWORD *linkmap, const Elf32_Ehdr *ehdr,
+					const Elf32_Phdr *phdrs);
+int bootcache_save(const bootcache *bc);
+int bootcache_read(const bootcache *bc, u32 pos, void *dst, u32 len);
+
+#endif
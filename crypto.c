@@ -22,6 +22,11 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #define		AES_CMD_RESET	0
 #define		AES_CMD_DECRYPT	0x9800
 
+#define		SHA_CMD_EXEC	0x80000000
+#define		SHA_BLOCKS_MAX	0x400
+
+static u8 sha_pad[128] MEM2_BSS ALIGNED(64);
+
 otp_t otp;
 seeprom_t seeprom;
 
@@ -46,6 +51,8 @@ void crypto_initialize(void)
 	crypto_read_seeprom();
 	write32(AES_CMD, 0);
 	while (read32(AES_CMD) != 0);
+	write32(SHA_CMD, 0);
+	while (read32(SHA_CMD) != 0);
 	irq_enable(IRQ_AES);
 }
 
@@ -142,6 +149,95 @@ void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv)
 
 }
 
+void sha_init(sha_ctx *ctx)
+{
+	while (read32(SHA_CMD) & SHA_CMD_EXEC);
+	write32(SHA_H0, 0x67452301);
+	write32(SHA_H1, 0xefcdab89);
+	write32(SHA_H2, 0x98badcfe);
+	write32(SHA_H3, 0x10325476);
+	write32(SHA_H4, 0xc3d2e1f0);
+	ctx->length = 0;
+	ctx->busy = 0;
+}
+
+void sha_wait(sha_ctx *ctx)
+{
+	if (!ctx->busy)
+		return;
+	while (read32(SHA_CMD) & SHA_CMD_EXEC);
+	ahb_flush_from(AHB_SHA1);
+	ahb_flush_to(AHB_STARLET);
+	ctx->busy = 0;
+}
+
+// starts hashing len bytes (whole 64 byte blocks only) and returns while
+// the engine is still running on the last command; the buffer must stay
+// untouched until sha_wait or the next sha_* call
+void sha_update_async(sha_ctx *ctx, const void *data, u32 len)
+{
+	const u8 *p = data;
+	u32 blocks;
+
+	len &= ~63;
+	sha_wait(ctx);
+	if (!len)
+		return;
+
+	dc_flushrange(p, len);
+	ahb_flush_to(AHB_SHA1);
+
+	while (len) {
+		blocks = len >> 6;
+		if (blocks > SHA_BLOCKS_MAX)
+			blocks = SHA_BLOCKS_MAX;
+
+		sha_wait(ctx);
+		write32(SHA_SRC, dma_addr((void *)p));
+		write32(SHA_CMD, SHA_CMD_EXEC | (blocks - 1));
+		ctx->busy = 1;
+
+		p += blocks << 6;
+		len -= blocks << 6;
+		ctx->length += blocks << 6;
+	}
+}
+
+void sha_final(sha_ctx *ctx, const void *data, u32 len, u8 *hash)
+{
+	u32 whole = len & ~63;
+	u32 total, size, h;
+	int i;
+
+	sha_update_async(ctx, data, whole);
+	len -= whole;
+	total = ctx->length + len;
+
+	// the engine is done with any earlier pad block once sha_wait returns
+	sha_wait(ctx);
+	memset(sha_pad, 0, sizeof(sha_pad));
+	memcpy(sha_pad, (const u8 *)data + whole, len);
+	sha_pad[len] = 0x80;
+	size = len < 56 ? 64 : 128;
+	// 64-bit big-endian bit count; the top three bytes stay zero
+	sha_pad[size - 5] = total >> 29;
+	sha_pad[size - 4] = total >> 21;
+	sha_pad[size - 3] = total >> 13;
+	sha_pad[size - 2] = total >> 5;
+	sha_pad[size - 1] = total << 3;
+
+	sha_update_async(ctx, sha_pad, size);
+	sha_wait(ctx);
+
+	for (i = 0; i < 5; i++) {
+		h = read32(SHA_H0 + 4*i);
+		hash[4*i] = h >> 24;
+		hash[4*i + 1] = h >> 16;
+		hash[4*i + 2] = h >> 8;
+		hash[4*i + 3] = h;
+	}
+}
+
 void aes_ipc(volatile ipc_request *req)
 {
 	switch (req->req) {
@@ -63,13 +63,19 @@ typedef struct
 	};
 } __attribute__((packed)) seeprom_t;
 
+typedef struct
+{
+	u32 length;
+	u8 busy;
+} sha_ctx;
+
 extern otp_t otp;
 extern seeprom_t seeprom;
 
 void crypto_read_otp();
 void crypto_ipc(volatile ipc_request *req);
 
-void crypto_initialize();
+void crypto_initialize() COLD;
 
 void aes_reset(void);
 void aes_set_iv(u8 *iv);
@@ -78,5 +84,10 @@ void aes_set_key(u8 *key);
 void aes_decrypt(u8 *src, u8 *dst, u32 blocks, u8 keep_iv);
 void aes_ipc(volatile ipc_request *req);
 
+void sha_init(sha_ctx *ctx);
+void sha_wait(sha_ctx *ctx);
+void sha_update_async(sha_ctx *ctx, const void *data, u32 len);
+void sha_final(sha_ctx *ctx, const void *data, u32 len, u8 *hash);
+
 #endif
 
@@ -19,7 +19,128 @@ Copyright (C) 2008, 2009	Haxx Enterprises <bushing@gmail.com>
 
 #define NOT_USED(x) (void)(x)
 
+// card generation FatFs last mounted; a change makes it remount
+static u32 disk_generation;
+
 static u8 buffer[512] MEM2_BSS ALIGNED(32);
+
+/*
+ * Write-back LRU sector cache.  Single-sector accesses (FAT, directory
+ * and FatFs window traffic) go through it; multi-sector file data
+ * transfers bypass it so that they don't flush out the hot metadata.
+ */
+#if DISK_CACHE_SECTORS > 0
+static u8 cache_data[DISK_CACHE_SECTORS][512] MEM2_BSS ALIGNED(32);
+
+static struct {
+	DWORD sector;
+	DWORD stamp;	/* cache_clock value at last use */
+	BYTE valid;
+	BYTE dirty;
+} cache_tag[DISK_CACHE_SECTORS];
+
+static DWORD cache_clock;
+static DCSTATS cache_stats;
+static u32 cache_generation;
+
+static void cache_invalidate(void)
+{
+	memset(cache_tag, 0, sizeof(cache_tag));
+	cache_clock = 0;
+}
+
+// Everything cached, dirty or not, belongs to the card it was read from.
+// Keyed to sdmmc's card generation rather than the new card flag, which
+// the PPC may ack first.
+static void cache_check_card(void)
+{
+	u32 gen = sdmmc_card_generation();
+
+	if (gen != cache_generation) {
+		cache_invalidate();
+		cache_generation = gen;
+	}
+}
+
+static int cache_lookup(DWORD sector)
+{
+	int i;
+
+	for (i = 0; i < DISK_CACHE_SECTORS; i++)
+		if (cache_tag[i].valid && cache_tag[i].sector == sector)
+			return i;
+	return -1;
+}
+
+static int cache_writeback(int i)
+{
+	if (!cache_tag[i].valid || !cache_tag[i].dirty)
+		return 0;
+	if (sdmmc_write(cache_tag[i].sector, 1, cache_data[i]) != 0)
+		return -1;
+	cache_tag[i].dirty = 0;
+	cache_stats.writebacks++;
+	return 0;
+}
+
+// find a free or the least recently used slot, writing it back if needed
+static int cache_victim(void)
+{
+	int i, victim = 0;
+
+	for (i = 0; i < DISK_CACHE_SECTORS; i++) {
+		if (!cache_tag[i].valid)
+			return i;
+		if (cache_tag[i].stamp < cache_tag[victim].stamp)
+			victim = i;
+	}
+	if (cache_writeback(victim) != 0)
+		return -1;
+	cache_tag[victim].valid = 0;
+	return victim;
+}
+
+static void cache_touch(int i)
+{
+	cache_tag[i].stamp = ++cache_clock;
+}
+
+static int cache_flush(void)
+{
+	int i, res = 0;
+
+	for (i = 0; i < DISK_CACHE_SECTORS; i++)
+		if (cache_writeback(i) != 0)
+			res = -1;
+	return res;
+}
+
+// a multi-sector transfer is about to touch sectors we may have cached
+static int cache_forget(DWORD sector, UINT count, int write_back)
+{
+	int i;
+
+	for (i = 0; i < DISK_CACHE_SECTORS; i++) {
+		if (!cache_tag[i].valid || cache_tag[i].sector < sector ||
+				cache_tag[i].sector >= sector + count)
+			continue;
+		if (write_back && cache_writeback(i) != 0)
+			return -1;
+		cache_tag[i].valid = 0;
+	}
+	return 0;
+}
+#endif
+
+// the SDHC can DMA straight into MEM1 and MEM2 if the buffer is line aligned
+static int dma_ok(const void *p)
+{
+	u32 addr = (u32)p;
+
+	if (addr & 31)
+		return 0;
+	return addr < 0x01800000 || (addr >= 0x10000000 && addr < 0x14000000);
+}
 
 // Initialize a Drive
 DSTATUS disk_initialize (BYTE drv) {
@@ -27,12 +148,20 @@ DSTATUS disk_initialize (BYTE drv) {
 		return STA_NOINIT;
 
 	sdmmc_ack_card();
+#if DISK_CACHE_SECTORS > 0
+	// only a different card makes the cache stale; a remount after
+	// f_forget() must not lose dirty sectors of the same one
+	cache_check_card();
+#endif
+	disk_generation = sdmmc_card_generation();
 	return disk_status(drv);
 }
 
 // Return Disk Status
 DSTATUS disk_status (BYTE drv) {
 	(void)drv;
+	if (sdmmc_card_generation() != disk_generation)
+		return STA_NOINIT;
 	if (sdmmc_check_card() == SDMMC_INSERTED)
 		return 0;
 	else
@@ -40,31 +169,85 @@ DSTATUS disk_status (BYTE drv) {
 }
 
 // Read Sector(s)
-DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, BYTE count) {
-	int i;
-	(void)drv;
-	for (i = 0; i < count; i++) {
-		if (sdmmc_read(sector+i, 1, buffer) != 0)
-			return RES_ERROR;
-		memcpy(buff + i * 512, buffer, 512);
-	}
+DRESULT disk_read (BYTE drv, BYTE *buff, DWORD sector, UINT count) {
+	UINT i;
+	int slot;
+	(void)drv;
+
+#if DISK_CACHE_SECTORS > 0
+	cache_check_card();
+	if (count == 1) {
+		slot = cache_lookup(sector);
+		if (slot >= 0) {
+			cache_stats.hits++;
+		} else {
+			cache_stats.misses++;
+			slot = cache_victim();
+			if (slot < 0 || sdmmc_read(sector, 1, cache_data[slot]) != 0)
+				return RES_ERROR;
+			cache_tag[slot].sector = sector;
+			cache_tag[slot].dirty = 0;
+			cache_tag[slot].valid = 1;
+		}
+		cache_touch(slot);
+		memcpy(buff, cache_data[slot], 512);
+		return RES_OK;
+	}
+
+	if (cache_forget(sector, count, 1) != 0)
+		return RES_ERROR;
+#endif
+
+	if (dma_ok(buff))
+		return sdmmc_read(sector, count, buff) == 0 ? RES_OK : RES_ERROR;
+
+	for (i = 0; i < count; i++) {
+		if (sdmmc_read(sector+i, 1, buffer) != 0)
+			return RES_ERROR;
+		memcpy(buff + i * 512, buffer, 512);
+	}
 
 	return RES_OK;
 }
 
 // Write Sector(s)
 #if _READONLY == 0
-DRESULT disk_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
-	int i;
+DRESULT disk_write (BYTE drv, const BYTE *buff, DWORD sector, UINT count) {
+	UINT i;
+	int slot;
 	NOT_USED(drv);
 
-	for (i = 0; i < count; i++) {
-		memcpy(buffer, buff + i * 512, 512);
-
-		if(sdmmc_write(sector + i, 1, buffer) != 0)
-			return RES_ERROR;
-	}
-
+#if DISK_CACHE_SECTORS > 0
+	cache_check_card();
+	if (count == 1) {
+		slot = cache_lookup(sector);
+		if (slot < 0) {
+			slot = cache_victim();
+			if (slot < 0)
+				return RES_ERROR;
+			cache_tag[slot].sector = sector;
+			cache_tag[slot].valid = 1;
+		}
+		memcpy(cache_data[slot], buff, 512);
+		cache_tag[slot].dirty = 1;
+		cache_touch(slot);
+		return RES_OK;
+	}
+
+	// whatever we have cached for this range is about to be overwritten
+	cache_forget(sector, count, 0);
+#endif
+
+	if (dma_ok(buff))
+		return sdmmc_write(sector, count, (void *)buff) == 0 ? RES_OK : RES_ERROR;
+
+	for (i = 0; i < count; i++) {
+		memcpy(buffer, buff + i * 512, 512);
+
+		if(sdmmc_write(sector + i, 1, buffer) != 0)
+			return RES_ERROR;
+	}
+
 	return RES_OK;
 }
 #endif /* _READONLY */
@@ -73,8 +256,29 @@ DRESULT disk_write (BYTE drv, const BYTE *buff, DWORD sector, BYTE count) {
 DRESULT disk_ioctl (BYTE drv, BYTE ctrl, void *buff) {
 	NOT_USED(drv);
 	NOT_USED(buff);
-	if (ctrl == CTRL_SYNC)
+
+#if DISK_CACHE_SECTORS > 0
+	cache_check_card();
+#endif
+
+	switch (ctrl) {
+	case CTRL_SYNC:
+#if DISK_CACHE_SECTORS > 0
+		if (cache_flush() != 0)
+			return RES_ERROR;
+#endif
 		return RES_OK;
+#if DISK_CACHE_SECTORS > 0
+	case CTRL_CACHE_STATS:
+		memcpy(buff, &cache_stats, sizeof(cache_stats));
+		return RES_OK;
+	case CTRL_FORGET:
+		// someone else is about to transfer these sectors
+		if (cache_forget(((DWORD *)buff)[0], ((DWORD *)buff)[1], 1) != 0)
+			return RES_ERROR;
+		return RES_OK;
+#endif
+	}
 
 	return RES_PARERR;
 }
@@ -21,11 +21,21 @@
 #define _READONLY	0	/* 1: Read-only mode */
 #define _USE_IOCTL	1
 
+/* Number of sectors kept in the MEM2 write-back cache (0: no cache) */
+#define DISK_CACHE_SECTORS	32
+
 #include "integer.h"
 
 /* Status of Disk Functions */
 typedef BYTE	DSTATUS;
 
+/* Sector cache statistics (CTRL_CACHE_STATS) */
+typedef struct {
+	DWORD	hits;
+	DWORD	misses;
+	DWORD	writebacks;
+} DCSTATS;
+
 /* Results of Disk Functions */
 typedef enum {
 	RES_OK = 0,		/* 0: Successful */
@@ -41,9 +51,9 @@ typedef enum {
 
 DSTATUS disk_initialize (BYTE);
 DSTATUS disk_status (BYTE);
-DRESULT disk_read (BYTE, BYTE*, DWORD, BYTE);
+DRESULT disk_read (BYTE, BYTE*, DWORD, UINT);
 #if	_READONLY == 0
-DRESULT disk_write (BYTE, const BYTE*, DWORD, BYTE);
+DRESULT disk_write (BYTE, const BYTE*, DWORD, UINT);
 #endif
 #if     _USE_IOCTL == 1
 DRESULT disk_ioctl (BYTE, BYTE, void*);
@@ -60,6 +70,8 @@ DRESULT disk_ioctl (BYTE, BYTE, void*);
 #if _USE_IOCTL == 1
 /* Command code for disk_ioctl() */
 #define CTRL_SYNC	0	/* Mandatory for write functions */
+#define CTRL_CACHE_STATS	100	/* Get DCSTATS of the sector cache */
+#define CTRL_FORGET	101	/* Write back and drop DWORD[2] {sector, count} */
 #endif
 
 #define _DISKIO
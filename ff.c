@@ -243,6 +243,100 @@ FRESULT move_window (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT sector cache                                                      */
+/*-----------------------------------------------------------------------*/
+
+#if _FAT_CACHE && !_FS_READONLY
+static
+FRESULT fat_wback (	/* Write back a FAT cache slot to all FAT copies */
+	FATFS *fs,		/* File system object */
+	BYTE slot		/* Slot to be written back if it is dirty */
+)
+{
+	DWORD wsect;
+	BYTE nf;
+
+
+	if (fs->fcdirty[slot]) {
+		wsect = fs->fcsect[slot];
+		if (disk_write(fs->drive, fs->fcbuf[slot], wsect, 1) != RES_OK)
+			return FR_DISK_ERR;
+		fs->fcdirty[slot] = 0;
+		for (nf = fs->n_fats; nf >= 2; nf--) {	/* Refrect the change to FAT copy */
+			wsect += fs->sects_fat;
+			disk_write(fs->drive, fs->fcbuf[slot], wsect, 1);
+		}
+	}
+
+	return FR_OK;
+}
+
+
+static
+FRESULT fat_flush (	/* Write back all dirty FAT cache slots */
+	FATFS *fs		/* File system object */
+)
+{
+	BYTE i;
+
+
+	for (i = 0; i < _FAT_CACHE; i++) {
+		if (fat_wback(fs, i) != FR_OK)
+			return FR_DISK_ERR;
+	}
+
+	return FR_OK;
+}
+#endif
+
+
+static
+BYTE* fat_window (	/* Pointer to the sector data, 0:Disk error */
+	FATFS *fs,		/* File system object */
+	DWORD sector	/* FAT sector number to be accessed */
+)
+{
+#if _FAT_CACHE
+	BYTE i, v;
+
+
+	v = 0;
+	for (i = 0; i < _FAT_CACHE; i++) {
+		if (fs->fcstamp[i] && fs->fcsect[i] == sector) {	/* Cache hit */
+			fs->fcstamp[i] = ++fs->fcclock;
+			fs->fcslot = i;
+			return fs->fcbuf[i];
+		}
+		if (fs->fcstamp[i] < fs->fcstamp[v]) v = i;	/* Least recently used slot */
+	}
+#if !_FS_READONLY
+	if (fat_wback(fs, v) != FR_OK)
+		return 0;
+#endif
+	fs->fcstamp[v] = 0;
+	if (disk_read(fs->drive, fs->fcbuf[v], sector, 1) != RES_OK)
+		return 0;
+	fs->fcsect[v] = sector;
+	fs->fcstamp[v] = ++fs->fcclock;
+	fs->fcslot = v;
+	return fs->fcbuf[v];
+#else
+	if (move_window(fs, sector) != FR_OK)
+		return 0;
+	return fs->win;
+#endif
+}
+
+#if _FAT_CACHE
+#define	FAT_DIRTY(fs)	((fs)->fcdirty[(fs)->fcslot] = 1)
+#else
+#define	FAT_DIRTY(fs)	((fs)->wflag = 1)
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Clean-up cached data                                                  */
 /*-----------------------------------------------------------------------*/
@@ -255,6 +349,10 @@ FRESULT sync (	/* FR_OK: successful, FR_DISK_ERR: failed */
 	FRESULT res;
 
 
+#if _FAT_CACHE
+	res = fat_flush(fs);
+	if (res == FR_OK)
+#endif
 	res = move_window(fs, 0);
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
@@ -292,6 +390,7 @@ DWORD get_cluster (	/* 0xFFFFFFFF:Disk error, 1:Interal error, Else:Cluster stat
 )
 {
 	WORD wc, bc;
+	BYTE *p;
 	DWORD fsect;
 
 
@@ -302,19 +401,19 @@ DWORD get_cluster (	/* 0xFFFFFFFF:Disk error, 1:Interal error, Else:Cluster stat
 	switch (fs->fs_type) {
 	case FS_FAT12 :
 		bc = (WORD)clst * 3 / 2;
-		if (move_window(fs, fsect + (bc / SS(fs)))) break;
-		wc = fs->win[bc & (SS(fs) - 1)]; bc++;
-		if (move_window(fs, fsect + (bc / SS(fs)))) break;
-		wc |= (WORD)fs->win[bc & (SS(fs) - 1)] << 8;
+		if (!(p = fat_window(fs, fsect + (bc / SS(fs))))) break;
+		wc = p[bc & (SS(fs) - 1)]; bc++;
+		if (!(p = fat_window(fs, fsect + (bc / SS(fs))))) break;
+		wc |= (WORD)p[bc & (SS(fs) - 1)] << 8;
 		return (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
 
 	case FS_FAT16 :
-		if (move_window(fs, fsect + (clst / (SS(fs) / 2)))) break;
-		return LD_WORD(&fs->win[((WORD)clst * 2) & (SS(fs) - 1)]);
+		if (!(p = fat_window(fs, fsect + (clst / (SS(fs) / 2))))) break;
+		return LD_WORD(&p[((WORD)clst * 2) & (SS(fs) - 1)]);
 
 	case FS_FAT32 :
-		if (move_window(fs, fsect + (clst / (SS(fs) / 4)))) break;
-		return LD_DWORD(&fs->win[((WORD)clst * 4) & (SS(fs) - 1)]) & 0x0FFFFFFF;
+		if (!(p = fat_window(fs, fsect + (clst / (SS(fs) / 4))))) break;
+		return LD_DWORD(&p[((WORD)clst * 4) & (SS(fs) - 1)]) & 0x0FFFFFFF;
 	}
 
 	return 0xFFFFFFFF;	/* An error occured at the disk I/O layer */
@@ -345,37 +444,39 @@ FRESULT put_cluster (
 
 	} else {
 		fsect = fs->fatbase;
+		res = FR_DISK_ERR;
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (WORD)clst * 3 / 2;
-			res = move_window(fs, fsect + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = &fs->win[bc & (SS(fs) - 1)];
+			if (!(p = fat_window(fs, fsect + (bc / SS(fs))))) break;
+			p += bc & (SS(fs) - 1);
 			*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;
 			bc++;
-			fs->wflag = 1;
-			res = move_window(fs, fsect + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = &fs->win[bc & (SS(fs) - 1)];
+			FAT_DIRTY(fs);
+			if (!(p = fat_window(fs, fsect + (bc / SS(fs))))) break;
+			p += bc & (SS(fs) - 1);
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 
 		case FS_FAT16 :
-			res = move_window(fs, fsect + (clst / (SS(fs) / 2)));
-			if (res != FR_OK) break;
-			ST_WORD(&fs->win[((WORD)clst * 2) & (SS(fs) - 1)], (WORD)val);
+			if (!(p = fat_window(fs, fsect + (clst / (SS(fs) / 2))))) break;
+			ST_WORD(&p[((WORD)clst * 2) & (SS(fs) - 1)], (WORD)val);
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 
 		case FS_FAT32 :
-			res = move_window(fs, fsect + (clst / (SS(fs) / 4)));
-			if (res != FR_OK) break;
-			ST_DWORD(&fs->win[((WORD)clst * 4) & (SS(fs) - 1)], val);
+			if (!(p = fat_window(fs, fsect + (clst / (SS(fs) / 4))))) break;
+			ST_DWORD(&p[((WORD)clst * 4) & (SS(fs) - 1)], val);
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 
 		default :
 			res = FR_INT_ERR;
 		}
-		fs->wflag = 1;
 	}
 
 	return res;
@@ -426,6 +527,61 @@ FRESULT remove_chain (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Find a run of free clusters                                           */
+/*-----------------------------------------------------------------------*/
+#if !_FS_READONLY
+static
+DWORD find_run (	/* 0:No free run, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top of the run */
+	FATFS *fs,		/* File system object */
+	DWORD clst,		/* Cluster# to start the search from */
+	DWORD ncl		/* Number of contiguous free clusters needed */
+)
+{
+	DWORD mcl, n, run, top, cs, sect, csect;
+	WORD epb;
+	BYTE *p;
+
+
+	mcl = fs->max_clust;
+	if (clst < 2 || clst >= mcl) clst = 2;
+	epb = (fs->fs_type == FS_FAT16) ? SS(fs) / 2 : SS(fs) / 4;	/* FAT entries per sector */
+	csect = 0; p = 0;
+	run = 0; top = 0;
+	for (n = mcl - 2; n; n--) {			/* Scan every cluster once */
+		if (fs->fs_type == FS_FAT12) {
+			cs = get_cluster(fs, clst);
+			if (cs == 1 || cs == 0xFFFFFFFF) return cs;
+		} else {						/* Pick the entries out of whole FAT sectors */
+			sect = fs->fatbase + clst / epb;
+			if (sect != csect) {
+				p = fat_window(fs, sect);
+				if (!p) return 0xFFFFFFFF;
+				csect = sect;
+			}
+			if (fs->fs_type == FS_FAT16)
+				cs = LD_WORD(&p[(clst % epb) * 2]);
+			else
+				cs = LD_DWORD(&p[(clst % epb) * 4]) & 0x0FFFFFFF;
+		}
+		if (cs == 0) {					/* Free cluster */
+			if (!run) top = clst;
+			if (++run == ncl) return top;
+		} else {
+			run = 0;
+		}
+		if (++clst >= mcl) {			/* Wrap around, a run cannot span it */
+			clst = 2; run = 0;
+		}
+	}
+
+	return 0;	/* No free run */
+}
+#endif /* !_FS_READONLY */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Stretch or create a cluster chain                                     */
 /*-----------------------------------------------------------------------*/
@@ -451,19 +607,9 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 		scl = clst;
 	}
 
-	ncl = scl;				/* Start cluster */
-	for (;;) {
-		ncl++;							/* Next cluster */
-		if (ncl >= mcl) {				/* Wrap around */
-			ncl = 2;
-			if (ncl > scl) return 0;	/* No free custer */
-		}
-		cs = get_cluster(fs, ncl);		/* Get the cluster status */
-		if (cs == 0) break;				/* Found a free cluster */
-		if (cs == 0xFFFFFFFF || cs == 1)/* An error occured */
-			return cs;
-		if (ncl == scl) return 0;		/* No free custer */
-	}
+	ncl = find_run(fs, scl + 1, 1);	/* Find a free cluster next to the start point */
+	if (ncl < 2 || ncl == 0xFFFFFFFF)	/* No free cluster or an error occured */
+		return ncl;
 
 	if (put_cluster(fs, ncl, 0x0FFFFFFF))	/* Mark the new cluster "in use" */
 		return 0xFFFFFFFF;
@@ -503,6 +649,39 @@ DWORD clust2sect (	/* !=0: sector number, 0: failed - invalid cluster# */
 
 
 
+#if _USE_FASTSEEK
+/*-----------------------------------------------------------------------*/
+/* Get cluster# from the cluster link map table                          */
+/*-----------------------------------------------------------------------*/
+/* The table is {size, {end, start}..., 0}, where end is the file cluster
+/  offset just past each fragment and start is its first cluster#. */
+
+static
+DWORD clmt_clust (	/* !=0: cluster number, 0: offset is beyond the table */
+	FIL *fp,		/* Pointer to the file object */
+	DWORD ofs		/* File offset to be converted to cluster# */
+)
+{
+	DWORD cl, *tbl = fp->cltbl + 1;
+	UINT lo, hi, mid, nfrag;
+
+
+	cl = ofs / SS(fp->fs) / fp->fs->csize;	/* Cluster order from top of the file */
+	nfrag = (UINT)(fp->cltbl[0] - 2) / 2;	/* Number of fragments in the table */
+	lo = 0; hi = nfrag;
+	while (lo < hi) {						/* Find the first fragment ending after cl */
+		mid = (lo + hi) / 2;
+		if (tbl[mid * 2] > cl) hi = mid;
+		else lo = mid + 1;
+	}
+	if (lo >= nfrag) return 0;
+	return tbl[lo * 2 + 1] + cl - (lo ? tbl[lo * 2 - 2] : 0);
+}
+#endif /* _USE_FASTSEEK */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Seek directory index                                                  */
 /*-----------------------------------------------------------------------*/
@@ -1467,6 +1646,13 @@ FRESULT auto_mount (	/* FR_OK(0): successful, !=0: any error occured */
 	}
 #endif
 	fs->winsect = 0;
+#if _FAT_CACHE
+	for (fsize = 0; fsize < _FAT_CACHE; fsize++) {	/* Discard FAT cache */
+		fs->fcstamp[fsize] = 0;
+		fs->fcdirty[fsize] = 0;
+	}
+	fs->fcclock = 0;
+#endif
 	fs->fs_type = fmt;			/* FAT syb-type */
 	fs->id = ++Fsid;			/* File system mount ID */
 	res = FR_OK;
@@ -1509,6 +1695,38 @@ FRESULT validate (	/* FR_OK(0): The object is valid, !=0: Invalid */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Drop Cached Volume State                                              */
+/*-----------------------------------------------------------------------*/
+/* Another bus master is about to write the card behind our back. Write
+   back the window and FAT cache and forget the volume, so that it is
+   mounted again from the card on next access. Files left open become
+   invalid and have to be opened again. */
+
+FRESULT f_forget (
+	BYTE vol		/* Logical drive number */
+)
+{
+	FATFS *fs;
+	FRESULT res = FR_OK;
+
+
+	if (vol >= _DRIVES) return FR_INVALID_DRIVE;
+	fs = FatFs[vol];
+	if (!fs || !fs->fs_type) return FR_OK;	/* Nothing cached */
+
+#if !_FS_READONLY
+	res = sync(fs);
+#endif
+	fs->winsect = 0;
+	fs->fs_type = 0;
+
+	return res;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Mount/Unmount a Locical Drive                                         */
 /*-----------------------------------------------------------------------*/
@@ -1636,6 +1854,12 @@ FRESULT f_open (
 	fp->fsize = LD_DWORD(dir+DIR_FileSize);	/* File size */
 	fp->fptr = 0; fp->csect = 255;		/* File pointer */
 	fp->dsect = 0;
+#if _USE_FASTSEEK
+	fp->cltbl = 0;						/* No cluster link map table */
+#endif
+#if _USE_STREAM && _FS_TINY
+	fp->sbuf = 0;						/* No stream sector buffer */
+#endif
 	fp->fs = dj.fs; fp->id = dj.fs->id;	/* Owner file system object of the file */
 
 	LEAVE_FF(dj.fs, FR_OK);
@@ -1656,8 +1880,8 @@ FRESULT f_read (
 )
 {
 	FRESULT res;
-	DWORD clst, sect, remain;
-	UINT rcnt, cc;
+	DWORD clst, nclst, sect, remain;
+	UINT rcnt, cc, csc;
 	BYTE *rbuff = buff;
 
 
@@ -1676,6 +1900,11 @@ FRESULT f_read (
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
 			if (fp->csect >= fp->fs->csize) {		/* On the cluster boundary? */
+#if _USE_FASTSEEK
+				if (fp->cltbl)
+					clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the link map table */
+				else
+#endif
 				clst = (fp->fptr == 0) ?			/* On the top of the file? */
 					fp->org_clust : get_cluster(fp->fs, fp->curr_clust);
 				if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
@@ -1688,11 +1917,24 @@ FRESULT f_read (
 			sect += fp->csect;
 			cc = btr / SS(fp->fs);					/* When remaining bytes >= sector size, */
 			if (cc) {								/* Read maximum contiguous sectors directly */
-				if (fp->csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - fp->csect;
-				if (disk_read(fp->fs->drive, rbuff, sect, (BYTE)cc) != RES_OK)
+				clst = fp->curr_clust;
+				csc = fp->fs->csize - fp->csect;	/* Contiguous sectors from sect */
+				while (csc < cc) {					/* Extend over physically consecutive clusters */
+#if _USE_FASTSEEK
+					if (fp->cltbl)
+						nclst = clmt_clust(fp, fp->fptr + (DWORD)csc * SS(fp->fs));
+					else
+#endif
+					nclst = get_cluster(fp->fs, clst);
+					if (nclst != clst + 1) break;
+					clst = nclst;
+					csc += fp->fs->csize;
+				}
+				if (cc > csc) cc = csc;				/* Clip at the end of the contiguous run */
+				if (disk_read(fp->fs->drive, rbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
-				fp->csect += (BYTE)cc;				/* Next sector address in the cluster */
+				fp->curr_clust = clst;				/* Last cluster touched by the read */
+				fp->csect = (BYTE)(fp->fs->csize - (csc - cc));	/* Next sector address in that cluster */
 				rcnt = SS(fp->fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
@@ -1743,8 +1985,8 @@ FRESULT f_write (
 )
 {
 	FRESULT res;
-	DWORD clst, sect;
-	UINT wcnt, cc;
+	DWORD clst, nclst, sect;
+	UINT wcnt, cc, csc;
 	const BYTE *wbuff = buff;
 
 
@@ -1776,6 +2018,15 @@ FRESULT f_write (
 				fp->csect = 0;						/* Reset sector address in the cluster */
 			}
 #if _FS_TINY
+#if _USE_STREAM
+			if (fp->sbuf) {
+				if (fp->flag & FA__DIRTY) {		/* Write back stream buffer prior to following direct transfer */
+					if (disk_write(fp->fs->drive, fp->sbuf, fp->dsect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+					fp->flag &= (BYTE)~FA__DIRTY;
+				}
+			} else
+#endif
 			if (fp->fs->winsect == fp->dsect && move_window(fp->fs, 0))	/* Write back data buffer prior to following direct transfer */
 				ABORT(fp->fs, FR_DISK_ERR);
 #else
@@ -1790,11 +2041,24 @@ FRESULT f_write (
 			sect += fp->csect;
 			cc = btw / SS(fp->fs);					/* When remaining bytes >= sector size, */
 			if (cc) {								/* Write maximum contiguous sectors directly */
-				if (fp->csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - fp->csect;
-				if (disk_write(fp->fs->drive, wbuff, sect, (BYTE)cc) != RES_OK)
+				clst = fp->curr_clust;
+				csc = fp->fs->csize - fp->csect;	/* Contiguous sectors from sect */
+				while (csc < cc) {					/* Extend over allocated and physically consecutive clusters */
+					nclst = get_cluster(fp->fs, clst);
+					if (nclst != clst + 1) break;
+					clst = nclst;
+					csc += fp->fs->csize;
+				}
+				if (cc > csc) cc = csc;				/* Clip at the end of the contiguous run */
+				if (disk_write(fp->fs->drive, wbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_TINY
+#if _USE_STREAM
+				if (fp->sbuf) {
+					if (fp->dsect - sect < cc)		/* Refill stream buffer if it gets dirty by the direct write */
+						mem_cpy(fp->sbuf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
+				} else
+#endif
 				if (fp->fs->winsect - sect < cc) {  /* Refill sector cache if it gets dirty by the direct write */
 					mem_cpy(fp->fs->win, wbuff + ((fp->fs->winsect - sect) * SS(fp->fs)), SS(fp->fs));
 					fp->fs->wflag = 0;
@@ -1805,11 +2069,19 @@ FRESULT f_write (
 					fp->flag &= ~FA__DIRTY;
 				}
 #endif
-				fp->csect += (BYTE)cc;				/* Next sector address in the cluster */
+				fp->curr_clust = clst;				/* Last cluster touched by the write */
+				fp->csect = (BYTE)(fp->fs->csize - (csc - cc));	/* Next sector address in that cluster */
 				wcnt = SS(fp->fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
 #if _FS_TINY
+#if _USE_STREAM
+			if (fp->sbuf) {
+				if (fp->dsect != sect && fp->fptr < fp->fsize &&	/* Fill stream buffer with file data */
+					disk_read(fp->fs->drive, fp->sbuf, sect, 1) != RES_OK)
+						ABORT(fp->fs, FR_DISK_ERR);
+			} else
+#endif
 			if (fp->fptr >= fp->fsize) {			/* Avoid silly buffer filling at growing edge */
 				if (move_window(fp->fs, 0)) ABORT(fp->fs, FR_DISK_ERR);
 				fp->fs->winsect = sect;
@@ -1827,6 +2099,13 @@ FRESULT f_write (
 		wcnt = SS(fp->fs) - (fp->fptr % SS(fp->fs));	/* Put partial sector into file I/O buffer */
 		if (wcnt > btw) wcnt = btw;
 #if _FS_TINY
+#if _USE_STREAM
+		if (fp->sbuf) {
+			mem_cpy(&fp->sbuf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector into stream buffer */
+			fp->flag |= FA__DIRTY;
+			continue;
+		}
+#endif
 		if (move_window(fp->fs, fp->dsect))			/* Move sector window */
 			ABORT(fp->fs, FR_DISK_ERR);
 		mem_cpy(&fp->fs->win[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
@@ -1868,6 +2147,12 @@ FRESULT f_sync (
 					LEAVE_FF(fp->fs, FR_DISK_ERR);
 				fp->flag &= (BYTE)~FA__DIRTY;
 			}
+#elif _USE_STREAM	/* Write-back dirty stream buffer */
+			if (fp->sbuf && (fp->flag & FA__DIRTY)) {
+				if (disk_write(fp->fs->drive, fp->sbuf, fp->dsect, 1) != RES_OK)
+					LEAVE_FF(fp->fs, FR_DISK_ERR);
+				fp->flag &= (BYTE)~FA__DIRTY;
+			}
 #endif
 			/* Update the directory entry */
 			res = move_window(fp->fs, fp->dir_sect);
@@ -1937,6 +2222,73 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fp->fs, res);
 	if (fp->flag & FA__ERROR)			/* Check abort flag */
 		LEAVE_FF(fp->fs, FR_INT_ERR);
+
+#if _USE_FASTSEEK
+	if (fp->cltbl) {	/* Fast seek */
+		DWORD *tbl, tlen, ulen, ncl, pcl, scl;
+
+#if !_FS_READONLY
+		if (fp->flag & FA_WRITE)		/* The table can't follow a growing file */
+			LEAVE_FF(fp->fs, FR_DENIED);
+#endif
+		if (ofs == CREATE_LINKMAP) {	/* Create the link map table */
+			tbl = fp->cltbl;
+			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+			clst = fp->org_clust;		/* Top of the chain */
+			ncl = 0;
+			if (clst) {
+				do {
+					scl = clst;			/* Get a fragment */
+					do {
+						pcl = clst; ncl++;
+						clst = get_cluster(fp->fs, clst);
+						if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
+						if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+					} while (clst == pcl + 1);
+					ulen += 2;			/* Store the length and top of the fragment */
+					if (ulen <= tlen) {
+						*tbl++ = ncl; *tbl++ = scl;
+					}
+				} while (clst < fp->fs->max_clust);	/* Repeat until end of chain */
+			}
+			*fp->cltbl = ulen;			/* Number of items used */
+			if (ulen <= tlen) {
+				*tbl = 0;				/* Terminate table */
+			} else {
+				fp->cltbl = 0;			/* Table too small, don't use it */
+				res = FR_NOT_ENOUGH_CORE;
+			}
+			LEAVE_FF(fp->fs, res);
+		}
+
+		if (ofs > fp->fsize) ofs = fp->fsize;	/* Clip offset at the file size */
+		fp->fptr = ofs; fp->csect = 255;
+		nsect = 0;
+		if (ofs > 0) {
+			clst = clmt_clust(fp, ofs - 1);	/* Cluster holding the previous byte */
+			if (!clst) ABORT(fp->fs, FR_INT_ERR);
+			fp->curr_clust = clst;
+			bcs = (DWORD)fp->fs->csize * SS(fp->fs);
+			ofs -= (ofs - 1) / bcs * bcs;		/* Offset in the cluster (1..bcs) */
+			fp->csect = (BYTE)(ofs / SS(fp->fs));
+			if (ofs % SS(fp->fs)) {
+				nsect = clust2sect(fp->fs, clst);
+				if (!nsect) ABORT(fp->fs, FR_INT_ERR);
+				nsect += fp->csect;
+				fp->csect++;
+			}
+		}
+		if (nsect && nsect != fp->dsect) {
+#if !_FS_TINY
+			if (disk_read(fp->fs->drive, fp->buf, nsect, 1) != RES_OK)
+				ABORT(fp->fs, FR_DISK_ERR);
+#endif
+			fp->dsect = nsect;
+		}
+		LEAVE_FF(fp->fs, FR_OK);
+	}
+#endif /* _USE_FASTSEEK */
+
 	if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
 		 && !(fp->flag & FA_WRITE)
@@ -2003,6 +2355,16 @@ FRESULT f_lseek (
 #endif
 		if (disk_read(fp->fs->drive, fp->buf, nsect, 1) != RES_OK)
 			ABORT(fp->fs, FR_DISK_ERR);
+#elif _USE_STREAM && !_FS_READONLY
+		if (fp->sbuf) {
+			if (fp->flag & FA__DIRTY) {			/* Write-back dirty stream buffer if needed */
+				if (disk_write(fp->fs->drive, fp->sbuf, fp->dsect, 1) != RES_OK)
+					ABORT(fp->fs, FR_DISK_ERR);
+				fp->flag &= (BYTE)~FA__DIRTY;
+			}
+			if (disk_read(fp->fs->drive, fp->sbuf, nsect, 1) != RES_OK)
+				ABORT(fp->fs, FR_DISK_ERR);
+		}
 #endif
 		fp->dsect = nsect;
 	}
@@ -2218,10 +2580,9 @@ FRESULT f_getfree (
 		f = 0; p = 0;
 		do {
 			if (!f) {
-				res = move_window(*fatfs, sect++);
-				if (res != FR_OK)
-					LEAVE_FF(*fatfs, res);
-				p = (*fatfs)->win;
+				p = fat_window(*fatfs, sect++);
+				if (!p)
+					LEAVE_FF(*fatfs, FR_DISK_ERR);
 			}
 			if (fat == FS_FAT16) {
 				if (LD_WORD(p) == 0) n++;
@@ -2579,6 +2940,181 @@ FRESULT f_forward (
 
 
 
+#if _USE_EXPAND && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Allocate a Contiguous Cluster Run for the File                        */
+/*-----------------------------------------------------------------------*/
+/* The clusters are linked to the end of the file's chain but the file
+/  size is not changed, so f_write just follows them as the file grows.
+/  Clusters left beyond the file size stay allocated until it is truncated. */
+
+FRESULT f_expand (
+	FIL *fp,		/* Pointer to the file object */
+	DWORD fsz		/* Number of bytes the cluster chain should cover */
+)
+{
+	FRESULT res;
+	DWORD bcs, ncl, n, clst, lcl, scl;
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (!(fp->flag & FA_WRITE))			/* Check access mode */
+		LEAVE_FF(fp->fs, FR_DENIED);
+
+	bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
+	ncl = fsz / bcs + ((fsz % bcs) ? 1 : 0);	/* Number of clusters needed */
+
+	/* Find the end of the current chain */
+	n = 0; lcl = 0;
+	clst = fp->org_clust;
+	if (clst) {
+		do {
+			lcl = clst; n++;
+			clst = get_cluster(fp->fs, clst);
+			if (clst <= 1) ABORT(fp->fs, FR_INT_ERR);
+			if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+		} while (clst < fp->fs->max_clust);
+	}
+	if (n >= ncl) LEAVE_FF(fp->fs, FR_OK);	/* Already large enough */
+	ncl -= n;
+
+	/* Find a free run, preferably right after the chain */
+	scl = find_run(fp->fs, lcl ? lcl + 1 : fp->fs->last_clust + 1, ncl);
+	if (scl == 0) LEAVE_FF(fp->fs, FR_DENIED);	/* No contiguous space */
+	if (scl == 1) ABORT(fp->fs, FR_INT_ERR);
+	if (scl == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+
+	/* Link the run and append it to the chain */
+	for (clst = scl; clst < scl + ncl - 1; clst++) {
+		res = put_cluster(fp->fs, clst, clst + 1);
+		if (res != FR_OK) ABORT(fp->fs, res);
+	}
+	res = put_cluster(fp->fs, clst, 0x0FFFFFFF);
+	if (res == FR_OK && lcl) res = put_cluster(fp->fs, lcl, scl);
+	if (res != FR_OK) ABORT(fp->fs, res);
+	if (!lcl) {
+		fp->org_clust = scl;			/* New chain, the directory entry must be updated */
+		fp->flag |= FA__WRITTEN;
+	}
+
+	fp->fs->last_clust = clst;			/* Update FSINFO */
+	if (fp->fs->free_clust != 0xFFFFFFFF) {
+		fp->fs->free_clust -= ncl;
+		fp->fs->fsi_flag = 1;
+	}
+
+	LEAVE_FF(fp->fs, FR_OK);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Release Clusters Beyond the File Size                                 */
+/*-----------------------------------------------------------------------*/
+/* Gives back what f_expand allocated but the file never grew into. Works
+/  with _FS_MINIMIZE = 2, where f_truncate is not available. */
+
+FRESULT f_trim (
+	FIL *fp		/* Pointer to the file object */
+)
+{
+	FRESULT res;
+	DWORD bcs, n, clst, ncl;
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if (!(fp->flag & FA_WRITE))			/* Check access mode */
+		LEAVE_FF(fp->fs, FR_DENIED);
+	if (!fp->org_clust) LEAVE_FF(fp->fs, FR_OK);	/* No chain */
+
+	if (fp->fsize == 0) {				/* Empty file, remove the entire chain */
+		res = remove_chain(fp->fs, fp->org_clust);
+		fp->org_clust = 0;
+		fp->flag |= FA__WRITTEN;
+	} else {
+		/* Find the cluster holding the last byte */
+		if (fp->fptr == fp->fsize) {
+			clst = fp->curr_clust;
+		} else {
+			bcs = (DWORD)fp->fs->csize * SS(fp->fs);
+			clst = fp->org_clust;
+			for (n = (fp->fsize - 1) / bcs; n; n--) {
+				clst = get_cluster(fp->fs, clst);
+				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
+				if (clst < 2 || clst >= fp->fs->max_clust) ABORT(fp->fs, FR_INT_ERR);
+			}
+		}
+		ncl = get_cluster(fp->fs, clst);
+		if (ncl == 0xFFFFFFFF) res = FR_DISK_ERR;
+		if (ncl == 1) res = FR_INT_ERR;
+		if (res == FR_OK && ncl < fp->fs->max_clust) {	/* Cut the chain after it */
+			res = put_cluster(fp->fs, clst, 0x0FFFFFFF);
+			if (res == FR_OK) res = remove_chain(fp->fs, ncl);
+		}
+	}
+	if (res != FR_OK) fp->flag |= FA__ERROR;
+
+	LEAVE_FF(fp->fs, res);
+}
+#endif /* _USE_EXPAND */
+
+
+
+#if _USE_STREAM && _FS_TINY && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Attach a Stream Sector Buffer to a Write-only File                    */
+/*-----------------------------------------------------------------------*/
+/* The buffer must hold one sector and stay valid until the file is closed
+/  or the buffer is detached by calling f_stream with a null pointer. */
+
+FRESULT f_stream (
+	FIL *fp,		/* Pointer to the file object */
+	BYTE *buf		/* Pointer to the sector buffer (null:detach) */
+)
+{
+	FRESULT res;
+
+
+	res = validate(fp->fs, fp->id);		/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	if (fp->flag & FA__ERROR)			/* Check abort flag */
+		LEAVE_FF(fp->fs, FR_INT_ERR);
+	if ((fp->flag & (FA_READ | FA_WRITE)) != FA_WRITE)	/* Check access mode */
+		LEAVE_FF(fp->fs, FR_DENIED);
+
+	if (fp->sbuf) {						/* Detach current buffer */
+		if (fp->flag & FA__DIRTY) {
+			if (disk_write(fp->fs->drive, fp->sbuf, fp->dsect, 1) != RES_OK)
+				ABORT(fp->fs, FR_DISK_ERR);
+			fp->flag &= (BYTE)~FA__DIRTY;
+		}
+		fp->sbuf = 0;
+	}
+
+	if (buf) {
+		if (move_window(fp->fs, 0))		/* Flush win[] and stop it tracking file data */
+			ABORT(fp->fs, FR_DISK_ERR);
+		fp->fs->winsect = 0;
+		if (fp->fptr % SS(fp->fs)) {	/* Load the sector under the file pointer */
+			if (disk_read(fp->fs->drive, buf, fp->dsect, 1) != RES_OK)
+				ABORT(fp->fs, FR_DISK_ERR);
+		}
+		fp->sbuf = buf;
+	}
+
+	LEAVE_FF(fp->fs, FR_OK);
+}
+#endif /* _USE_STREAM */
+
+
+
 #if _USE_MKFS && !_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Create File System on the Drive                                       */
@@ -60,6 +60,13 @@
 /  data transfer. This reduces memory consumption 512 bytes each file object. */
 
 
+#define	_FAT_CACHE	4
+/* Number of FAT sectors cached in the file system object apart from win[]
+/  (0:disabled). FAT lookups then don't evict directory or file data from
+/  win[], and a changed FAT sector is written to all FAT copies only when it
+/  is evicted or the file system is synced. Each sector costs _MAX_SS bytes. */
+
+
 #define	_USE_STRFUNC	1
 /* To enable string functions, set _USE_STRFUNC to 1 or 2. */
 
@@ -72,6 +79,27 @@
 /* To enable f_forward function, set _USE_FORWARD to 1 and set _FS_TINY to 1. */
 
 
+#define	_USE_EXPAND	1
+/* To enable f_expand function, set _USE_EXPAND to 1 and set _FS_READONLY to 0.
+/  f_expand allocates a physically contiguous cluster run for a file ahead of
+/  writing, so the file does not fragment as it grows; f_trim gives back
+/  what the file did not grow into. */
+
+
+#define	_USE_STREAM	1
+/* To enable f_stream function, set _USE_STREAM to 1 and set _FS_TINY to 1.
+/  f_stream gives a write-only file its own sector buffer, so small appends
+/  are gathered there and written as full sectors without going through
+/  win[]. */
+
+
+#define	_USE_FASTSEEK	1
+/* To enable fast seek feature, set _USE_FASTSEEK to 1. A read-only file object
+/  can then be given a cluster link map table (FIL.cltbl), built by calling
+/  f_lseek(fp, CREATE_LINKMAP). After that f_lseek and f_read look clusters up
+/  in the table instead of following the FAT chain. */
+
+
 #define _DRIVES		1
 /* Number of volumes (logical drives) to be used. */
 
@@ -184,6 +212,14 @@ typedef struct _FATFS {
 	DWORD	database;	/* Data start sector */
 	DWORD	winsect;	/* Current sector appearing in the win[] */
 	BYTE	win[_MAX_SS];/* Disk access window for Directory/FAT */
+#if _FAT_CACHE
+	BYTE	fcslot;		/* FAT cache slot used by the last fat_window() */
+	BYTE	fcdirty[_FAT_CACHE];	/* FAT cache dirty flags */
+	DWORD	fcclock;	/* FAT cache access counter */
+	DWORD	fcstamp[_FAT_CACHE];	/* Last access of each FAT cache slot (0:empty) */
+	DWORD	fcsect[_FAT_CACHE];		/* FAT sector held in each FAT cache slot */
+	BYTE	fcbuf[_FAT_CACHE][_MAX_SS];	/* FAT cache sectors */
+#endif
 } FATFS;
 
 
@@ -223,6 +259,12 @@ typedef struct _FIL {
 	DWORD	dir_sect;	/* Sector containing the directory entry */
 	BYTE*	dir_ptr;	/* Ponter to the directory entry in the window */
 #endif
+#if _USE_FASTSEEK
+	DWORD*	cltbl;		/* Pointer to the cluster link map table (null:not used) */
+#endif
+#if _USE_STREAM && _FS_TINY
+	BYTE*	sbuf;		/* Pointer to the stream sector buffer (null:not used) */
+#endif
 #if !_FS_TINY
 	BYTE	buf[_MAX_SS];/* File R/W buffer */
 #endif
@@ -361,7 +403,8 @@ typedef enum {
 	FR_NOT_ENABLED,		/* 12 */
 	FR_NO_FILESYSTEM,	/* 13 */
 	FR_MKFS_ABORTED,	/* 14 */
-	FR_TIMEOUT			/* 15 */
+	FR_TIMEOUT,			/* 15 */
+	FR_NOT_ENOUGH_CORE	/* 16 */
 } FRESULT;
 
 
@@ -388,6 +431,10 @@ FRESULT f_utime (const char*, const FILINFO*);		/* Change timestamp of the file/
 FRESULT f_rename (const char*, const char*);		/* Rename/Move a file or directory */
 FRESULT f_forward (FIL*, UINT(*)(const BYTE*,UINT), UINT, UINT*);	/* Forward data to the stream */
 FRESULT f_mkfs (BYTE, BYTE, WORD);					/* Create a file system on the drive */
+FRESULT f_expand (FIL*, DWORD);						/* Allocate a contiguous cluster run for the file */
+FRESULT f_trim (FIL*);								/* Release clusters beyond the file size */
+FRESULT f_stream (FIL*, BYTE*);						/* Attach a sector buffer to a write-only file */
+FRESULT f_forget (BYTE);							/* Write back and drop cached volume state */
 
 #if _USE_STRFUNC
 int f_putc (int, FIL*);								/* Put a character to the file */
@@ -447,6 +494,11 @@ void ff_rel_grant(_SYNC_t);
 #define FA__ERROR			0x80
 
 
+/* Fast seek function (f_lseek offset) */
+
+#define CREATE_LINKMAP		0xFFFFFFFF
+
+
 /* FAT sub type (FATFS.fs_type) */
 
 #define FS_FAT12	1
@@ -32,6 +32,31 @@ static u8 gecko_console_enabled = 0;
 
 #define LOG_FILE "/bootmii/log.txt"
 
+#ifndef NDEBUG
+// gecko_printf only appends to this ring; the SD log file and the PPC
+// screen mailbox each drain it at their own pace from gecko_log_drain().
+#define LOG_RING_SIZE		(16*1024)
+#define LOG_RING_MASK		(LOG_RING_SIZE - 1)
+#define LOG_SLICE_SD		2048
+#define LOG_SLICE_PPC		64
+#define LOG_PPC_MAILBOX		0x01200000
+#define LOG_PREALLOC		(64 * 1024) // contiguous room kept ahead of the log's end
+#define LOG_PPC_TIMEOUT		HW_TIMER_MS2TICKS(60) // three missed vsyncs
+
+static char log_ring[LOG_RING_SIZE] MEM2_BSS ALIGNED(32);
+log_shm gecko_log_shm MEM2_BSS ALIGNED(32);
+static u8 log_sbuf[512] MEM2_BSS ALIGNED(32);
+static FIL log_file;
+static u8 log_file_open = 0;
+static u32 log_alloc_end;
+static u8 log_draining = 0;
+static u32 log_head = 0;
+static u32 log_sd_tail = 0;
+static u32 log_ppc_tail = 0;
+static u32 log_ppc_stall = 0;
+static u32 log_dropped = 0;
+#endif
+
 static u32 _gecko_command(u32 command)
 {
 	u32 i;
@@ -211,6 +236,12 @@ static int gecko_sendbuffer_safe(const void *buffer, u32 size)
 void gecko_init(void)
 {	if(read16(0x01200002) == 0XDEB6)
 		gecko_enabled |= 1;
+#ifndef NDEBUG
+	memset(&gecko_log_shm, 0, 3*32);
+	gecko_log_shm.magic = LOG_SHM_MAGIC;
+	gecko_log_shm.size = LOG_SHM_SIZE;
+	dc_flushrange(&gecko_log_shm, 3*32);
+#endif
 	write32(EXI0_CSR, 0);
 	write32(EXI1_CSR, 0);
 	write32(EXI2_CSR, 0);
@@ -227,6 +258,12 @@ void gecko_init(void)
 u8 gecko_enable(const u8 enable)
 {	if(enable)
 		return gecko_enabled |= 1;
+#ifndef NDEBUG
+	// let the PPC show what is still queued before it goes away
+	if(gecko_enabled & 1)
+		gecko_log_flush();
+	log_ppc_tail = log_head;
+#endif
 	return gecko_enabled &= ~1;
 }
 
@@ -242,6 +279,230 @@ u8 gecko_enable_console(const u8 enable)
 }
 
 #ifndef NDEBUG
+// bytes queued for the slowest consumer that is still active
+static u32 _log_pending(void)
+{
+	u32 pending = log_head - log_sd_tail;
+
+	if((gecko_enabled & 1) && (log_head - log_ppc_tail) > pending)
+		pending = log_head - log_ppc_tail;
+	return pending;
+}
+
+static void _log_put(const char *buf, u32 len)
+{
+	u32 i;
+
+	for(i = 0; i < len; i++)
+		log_ring[(log_head + i) & LOG_RING_MASK] = buf[i];
+	log_head += len;
+}
+
+static int _log_note(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int i;
+
+	va_start(args, fmt);
+	i = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return i;
+}
+
+static void _log_append(const char *buf, u32 len)
+{
+	char note[40];
+	u32 cookie, n;
+
+	cookie = irq_kill();
+	if(log_dropped) {
+		n = _log_note(note, sizeof(note), "[%u log bytes dropped]\n", log_dropped);
+		if(_log_pending() + n + len <= LOG_RING_SIZE) {
+			_log_put(note, n);
+			log_dropped = 0;
+		}
+	}
+	if(!log_dropped && _log_pending() + len <= LOG_RING_SIZE)
+		_log_put(buf, len);
+	else
+		log_dropped += len;
+	if(!(gecko_enabled & 1))
+		log_ppc_tail = log_head;
+	irq_restore(cookie);
+}
+
+static void _log_drain_sd(u32 budget)
+{
+	u32 head = log_head;
+	u32 n, done;
+
+	if(log_sd_tail == head)
+		return;
+	if(!log_file_open) {
+		if(f_open(&log_file, LOG_FILE, FA_OPEN_ALWAYS|FA_WRITE) != FR_OK)
+			return; // not mounted yet, keep it queued
+		if(f_lseek(&log_file, log_file.fsize) != FR_OK ||
+		   f_stream(&log_file, log_sbuf) != FR_OK) {
+			f_close(&log_file);
+			return;
+		}
+		log_file_open = 1;
+		log_alloc_end = 0;
+	}
+
+	// Grow the file a contiguous LOG_PREALLOC step at a time rather than a
+	// cluster per line; gecko_log_close gives back what is left unused. If
+	// there is no contiguous room f_write just allocates as usual.
+	if(log_file.fsize + (head - log_sd_tail) > log_alloc_end) {
+		log_alloc_end = log_file.fsize + (head - log_sd_tail) + LOG_PREALLOC;
+		f_expand(&log_file, log_alloc_end);
+	}
+
+	while(budget && log_sd_tail != head) {
+		n = head - log_sd_tail;
+		if(n > LOG_RING_SIZE - (log_sd_tail & LOG_RING_MASK))
+			n = LOG_RING_SIZE - (log_sd_tail & LOG_RING_MASK);
+		if(n > budget)
+			n = budget;
+		if(f_write(&log_file, &log_ring[log_sd_tail & LOG_RING_MASK], n, &done) != FR_OK || !done)
+			break;
+		log_sd_tail += done;
+		budget -= done;
+	}
+
+	if(f_sync(&log_file) != FR_OK) {
+		f_close(&log_file);
+		log_file_open = 0;
+	}
+}
+
+// hands the PPC as much as fits in the shared ring in one go
+static void _log_drain_shm(u32 budget)
+{
+	log_shm *shm = &gecko_log_shm;
+	u32 head = log_head;
+	u32 n, off, chunk;
+
+	dc_invalidaterange((void *)&shm->tail, 32);
+	n = head - log_ppc_tail;
+	if(n > LOG_SHM_SIZE - (shm->head - shm->tail))
+		n = LOG_SHM_SIZE - (shm->head - shm->tail);
+	if(n > budget)
+		n = budget;
+
+	while(n) {
+		off = shm->head & (LOG_SHM_SIZE - 1);
+		chunk = n;
+		if(chunk > LOG_SHM_SIZE - off)
+			chunk = LOG_SHM_SIZE - off;
+		if(chunk > LOG_RING_SIZE - (log_ppc_tail & LOG_RING_MASK))
+			chunk = LOG_RING_SIZE - (log_ppc_tail & LOG_RING_MASK);
+		memcpy(&shm->data[off], &log_ring[log_ppc_tail & LOG_RING_MASK], chunk);
+		dc_flushrange(&shm->data[off], chunk);
+		shm->head += chunk;
+		log_ppc_tail += chunk;
+		n -= chunk;
+	}
+	dc_flushrange((void *)&shm->head, 32);
+}
+
+// gives up on a PPC that has not taken anything for LOG_PPC_TIMEOUT
+static int _log_ppc_stalled(void)
+{
+	if(!log_ppc_stall) {
+		log_ppc_stall = read32(HW_TIMER) | 1;
+		return 0;
+	}
+	if((read32(HW_TIMER) - log_ppc_stall) <= LOG_PPC_TIMEOUT)
+		return 0;
+	gecko_enabled &= ~1;
+	log_ppc_tail = log_head;
+	return 1;
+}
+
+// the PPC takes one character per vsync through the mailbox; never wait
+// for it here, just pick up where we left off on the next drain
+static void _log_drain_ppc(u32 budget)
+{
+	u32 start = log_ppc_tail;
+
+	dc_invalidaterange((void *)&gecko_log_shm.tail, 32);
+	if(gecko_log_shm.reader) {
+		_log_drain_shm(LOG_SHM_SIZE);
+		if(log_ppc_tail != start || log_ppc_tail == log_head)
+			log_ppc_stall = 0;
+		else
+			_log_ppc_stalled();
+		return;
+	}
+
+	while(budget-- && log_ppc_tail != log_head) {
+		dc_invalidaterange((void*)LOG_PPC_MAILBOX, 32);
+		if(read8(LOG_PPC_MAILBOX)) {
+			if(_log_ppc_stalled()) {
+				write8(LOG_PPC_MAILBOX, 'X');
+				dc_flushrange((void*)LOG_PPC_MAILBOX, 32);
+			}
+			return;
+		}
+		log_ppc_stall = 0;
+		write8(LOG_PPC_MAILBOX, log_ring[log_ppc_tail & LOG_RING_MASK]);
+		dc_flushrange((void*)LOG_PPC_MAILBOX, 32);
+		log_ppc_tail++;
+	}
+}
+
+void gecko_log_drain(void)
+{
+	if(log_draining)
+		return;
+	log_draining = 1;
+	_log_drain_sd(LOG_SLICE_SD);
+	if(gecko_enabled & 1)
+		_log_drain_ppc(LOG_SLICE_PPC);
+	log_draining = 0;
+}
+
+// writes everything queued to the SD log right away, so a boot that hangs
+// later still leaves a log behind; the PPC's share waits for the next drain
+void gecko_log_sync(void)
+{
+	if(log_draining)
+		return;
+	log_draining = 1;
+	_log_drain_sd(LOG_RING_SIZE);
+	log_draining = 0;
+}
+
+// closes the SD log, releasing the clusters preallocated beyond its end;
+// anything still queued stays in the ring and reopens it on the next drain
+void gecko_log_close(void)
+{
+	if(log_draining)
+		return;
+	log_draining = 1;
+	if(log_file_open) {
+		f_trim(&log_file);
+		f_close(&log_file);
+		log_file_open = 0;
+	}
+	log_draining = 0;
+}
+
+void gecko_log_flush(void)
+{
+	if(log_draining)
+		return;
+	log_draining = 1;
+	_log_drain_sd(LOG_RING_SIZE);
+	while((gecko_enabled & 1) && log_ppc_tail != log_head) {
+		_log_drain_ppc(LOG_RING_SIZE);
+		if(log_ppc_tail != log_head)
+			udelay(1000);
+	}
+	log_draining = 0;
+}
+
 int gecko_printf(const char *fmt, ...)
 {	
 	if(!gecko_enabled)
@@ -249,41 +510,12 @@ int gecko_printf(const char *fmt, ...)
 	va_list args;
 	char buffer[256];
 	int i;
-	FIL logFile;
 
 	va_start(args, fmt);
 	i = vsprintf(buffer, fmt, args);
 	va_end(args);
-	fmt = buffer;
 	if(gecko_enabled & 1)
-	{	if(f_open(&logFile, LOG_FILE, FA_OPEN_ALWAYS|FA_WRITE) == FR_OK)
-		{	f_lseek(&logFile, logFile.fsize);
-			f_puts(fmt, &logFile);
-			f_close(&logFile);
-		}
-		while(*fmt)
-		{	/*do
-					dc_invalidaterange((void*)0x01200000,32);
-			while(read8(0x01200000));*/
-			dc_invalidaterange((void*)0x01200000,32);
-			if(read8(0x01200000))
-			{	udelay(20000); // wait for PPC's vsync
-				dc_invalidaterange((void*)0x01200000,32);
-				if(read8(0x01200000))
-				{	udelay(20000); // wait for PPC's vsync AGAIN
-					dc_invalidaterange((void*)0x01200000,32);
-					if(read8(0x01200000))
-					{	gecko_enable(0);
-						write8(0x01200000, 'X');
-						break;
-					}
-				}
-			}
-			write8(0x01200000, *fmt);
-			dc_flushrange((void*)0x01200000,32);
-			fmt++;
-		}
-	}
+		_log_append(buffer, i);
 /*		{	dc_invalidaterange((void*)0x01200000,256);
 			for(c = 0x01200000; c<0x01200099; c++)
 				if(!read8(c))
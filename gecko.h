@@ -14,11 +14,39 @@ Copyright (C) 2009		Andre Heider "dhewg" <dhewg@wiibrew.org>
 #ifndef __GECKO_H__
 #define __GECKO_H__
 
-#ifdef CAN_HAZ_USBGECKO
-
 #include "types.h"
 
-void gecko_init(void);
+#define LOG_SHM_MAGIC	0x4c4f4752 // "LOGR"
+#define LOG_SHM_SIZE	(16*1024)
+
+// Log ring shared with the PPC, found through __ipc_info.log_ring or
+// IPC_SYS_GETLOGRING. mini is the only writer of head and data, the PPC
+// the only writer of tail and reader; each index sits in its own cache
+// line, so both sides flush/invalidate just what they own. head and tail
+// are free-running byte counts, data[head % size] is the next free byte.
+// mini keeps using the 0x01200000 mailbox until the PPC sets reader.
+typedef struct {
+	u32 magic;
+	u32 size;
+	u32 pad0[6];
+	vu32 head;
+	u32 pad1[7];
+	vu32 tail;
+	vu32 reader;
+	u32 pad2[6];
+	char data[LOG_SHM_SIZE];
+} log_shm;
+
+#if defined(CAN_HAZ_USBGECKO) && !defined(NDEBUG)
+extern log_shm gecko_log_shm;
+#define GECKO_LOG_SHM	(&gecko_log_shm)
+#else
+#define GECKO_LOG_SHM	NULL
+#endif
+
+#ifdef CAN_HAZ_USBGECKO
+
+void gecko_init(void) COLD;
 u8 gecko_enable_console(const u8 enable);
 u8 gecko_enable(const u8 enable);
 
@@ -28,6 +56,18 @@ u8 gecko_enable(const u8 enable);
 int gecko_printf(const char *fmt, ...) __attribute__((format (printf, 1, 2)));
 #endif
 
+#ifdef NDEBUG
+#define gecko_log_drain(...) do { } while(0)
+#define gecko_log_sync(...) do { } while(0)
+#define gecko_log_flush(...) do { } while(0)
+#define gecko_log_close(...) do { } while(0)
+#else
+void gecko_log_drain(void);
+void gecko_log_sync(void);
+void gecko_log_flush(void);
+void gecko_log_close(void);
+#endif
+
 void gecko_process(void);
 
 #else
@@ -35,6 +75,10 @@ void gecko_process(void);
 #define gecko_enable_console(...) do { } while(0)
 #define gecko_printf(...) do { } while(0)
 #define gecko_process(...) do { } while(0)
+#define gecko_log_drain(...) do { } while(0)
+#define gecko_log_sync(...) do { } while(0)
+#define gecko_log_flush(...) do { } while(0)
+#define gecko_log_close(...) do { } while(0)
 #define gecko_timer(...) do { } while(0)
 #endif
 
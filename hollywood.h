@@ -28,6 +28,10 @@ Copyright (C) 2008, 2009	John Kelley <wiidev@kelley.ca>
 #define		HW_TIMER		(HW_REG_BASE + 0x010)
 #define		HW_ALARM		(HW_REG_BASE + 0x014)
 
+// HW_TIMER and HW_ALARM tick at ~1.898MHz
+#define		HW_TIMER_HZ		1898000
+#define		HW_TIMER_MS2TICKS(ms)	((ms) * (HW_TIMER_HZ / 1000))
+
 #define		HW_PPCIRQFLAG		(HW_REG_BASE + 0x030)
 #define		HW_PPCIRQMASK		(HW_REG_BASE + 0x034)
 
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+
+# Turns a function profile into hot.ld, the hot function order included by
+# mini.ld. The profile has one "<samples> <function>" pair per line, in any
+# order, where samples is how often the PC was caught in that function;
+# lines starting with # are ignored.
+#
+# usage: hotorder.py profile.txt [coverage percent] > hot.ld
+
+import sys
+
+# assembler objects have no per-function sections, so place them whole
+asm = {
+	"v_irq": "*irq_asm.o(.text)",
+	"irq_kill": "*irq_asm.o(.text)",
+	"irq_restore": "*irq_asm.o(.text)",
+	"_dc_inval_entries": "*memory_asm.o(.text)",
+	"_dc_flush_entries": "*memory_asm.o(.text)",
+	"_dc_flush": "*memory_asm.o(.text)",
+	"_dc_inval": "*memory_asm.o(.text)",
+	"_ic_inval": "*memory_asm.o(.text)",
+	"_tlb_inval": "*memory_asm.o(.text)",
+	"_drain_write_buffer": "*memory_asm.o(.text)",
+	"memcpy32": "*utils_asm.o(.text)",
+	"memset32": "*utils_asm.o(.text)",
+	"memcpy16": "*utils_asm.o(.text)",
+	"memset16": "*utils_asm.o(.text)",
+	"memcpy8": "*utils_asm.o(.text)",
+	"memset8": "*utils_asm.o(.text)",
+}
+
+coverage = 95.0
+if len(sys.argv) > 2:
+	coverage = float(sys.argv[2])
+
+funcs = []
+for line in open(sys.argv[1]):
+	line = line.strip()
+	if not line or line.startswith("#"):
+		continue
+	count, name = line.split(None, 1)
+	funcs.append((int(count), name))
+
+funcs.sort(key=lambda f: -f[0])
+total = sum(f[0] for f in funcs)
+
+print("/* Hot function order for the .text output section in mini.ld,")
+print("   generated by hotorder.py from %s (%d samples). */" % (sys.argv[1], total))
+
+seen = set()
+acc = 0
+for count, name in funcs:
+	if total and acc * 100.0 / total >= coverage:
+		break
+	acc += count
+	if name.startswith("<") or name.startswith("0x"):
+		continue
+	pattern = asm.get(name, "*(.text.%s)" % name)
+	if pattern in seen:
+		continue
+	seen.add(pattern)
+	print("%s /* %d */" % (pattern, count))
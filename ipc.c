@@ -28,6 +28,9 @@ Copyright (C) 2009		John Kelley <wiidev@kelley.ca>
 #include "boot2.h"
 #include "powerpc.h"
 #include "panic.h"
+#include "trace.h"
+#include "profile.h"
+#include "mem2.h"
 
 #define MINI_VERSION_MAJOR 1
 #define MINI_VERSION_MINOR 3
@@ -36,6 +39,10 @@ static volatile ipc_request in_queue[IPC_IN_SIZE] ALIGNED(32) MEM2_BSS;
 static volatile ipc_request out_queue[IPC_OUT_SIZE] ALIGNED(32) MEM2_BSS;
 static volatile ipc_request slow_queue[IPC_SLOW_SIZE];
 
+// the ARM only ever writes the out queue, so it goes through the uncached
+// MEM2 window and a posted message just needs the write buffer drained
+#define out_uncached ((volatile ipc_request *)mem2_uncached(out_queue))
+
 extern char __mem2_area_start[];
 
 // These defines are for the ARMCTRL regs
@@ -65,6 +72,7 @@ const ipc_infohdr __ipc_info ALIGNED(32) MEM2_RODATA = {
 	.ipc_in_size = IPC_IN_SIZE,
 	.ipc_out = out_queue,
 	.ipc_out_size = IPC_OUT_SIZE,
+	.log_ring = GECKO_LOG_SHM,
 };
 
 static u16 slow_queue_head;
@@ -100,19 +108,19 @@ void ipc_post(u32 code, u32 tag, u32 num_args, ...)
 	u32 cookie = irq_kill();
 
 	if(peek_outhead() == ((out_tail + 1)&(IPC_OUT_SIZE-1))) {
-		gecko_printf("IPC: out queue full, PPC slow/dead/flooded\n");
+		TRACE("IPC: out queue full, PPC slow/dead/flooded\n");
 		while(peek_outhead() == ((out_tail + 1)&(IPC_OUT_SIZE-1)));
 	}
-	out_queue[out_tail].code = code;
-	out_queue[out_tail].tag = tag;
+	out_uncached[out_tail].code = code;
+	out_uncached[out_tail].tag = tag;
 	if(num_args) {
 		va_start(ap, num_args);
 		while(num_args--) {
-			out_queue[out_tail].args[arg++] = va_arg(ap, u32);
+			out_uncached[out_tail].args[arg++] = va_arg(ap, u32);
 		}
 		va_end(ap);
 	}
-	dc_flush_block_fast((void*)&out_queue[out_tail]);
+	dc_drain();
 	out_tail = (out_tail+1)&(IPC_OUT_SIZE-1);
 	poke_outtail(out_tail);
 	write32(HW_IPC_ARMCTRL, IPC_CTRL_IRQ_IN | IPC_CTRL_OUT);
@@ -148,6 +156,31 @@ static u32 process_slow(volatile ipc_request *req)
 					dc_flushrange((void *)req->args[0], 32);
 					ipc_post(req->code, req->tag, 0);
 					break;
+				case IPC_SYS_GETLOGRING:
+					ipc_post(req->code, req->tag, 1, (u32)GECKO_LOG_SHM);
+					break;
+				case IPC_SYS_GETTRACE:
+					req->args[1] = trace_copy((void *)req->args[0], req->args[1]);
+					dc_flushrange((void *)req->args[0], req->args[1]);
+					ipc_post(req->code, req->tag, 1, req->args[1]);
+					break;
+				case IPC_SYS_PROFILE:
+					if(req->args[0])
+						profile_start(req->args[0]);
+					else
+						profile_stop();
+					ipc_post(req->code, req->tag, 0);
+					break;
+				case IPC_SYS_GETPROFILE:
+					req->args[1] = profile_copy((void *)req->args[0], req->args[1]);
+					dc_flushrange((void *)req->args[0], req->args[1]);
+					ipc_post(req->code, req->tag, 1, req->args[1]);
+					break;
+				case IPC_SYS_GETMEM2:
+					req->args[1] = mem2_copy_stats((void *)req->args[0], req->args[1]);
+					dc_flushrange((void *)req->args[0], req->args[1]);
+					ipc_post(req->code, req->tag, 1, req->args[1]);
+					break;
 				default:
 					gecko_printf("IPC: unknown SLOW SYS request %04x\n", req->req);
 			}
@@ -343,6 +376,7 @@ u32 ipc_process_slow(void)
 		if (!vector)
 		{
 			gecko_process();
+			gecko_log_drain();
 
 			u32 cookie = irq_kill();
 			if(slow_queue_head == slow_queue_tail)
@@ -50,6 +50,11 @@ Copyright (C) 2009		John Kelley <wiidev@kelley.ca>
 #define IPC_SYS_JUMP	0x0001
 #define IPC_SYS_GETVERS 0x0002
 #define IPC_SYS_GETGITS 0x0003
+#define IPC_SYS_GETTRACE 0x0004
+#define IPC_SYS_GETLOGRING 0x0005
+#define IPC_SYS_PROFILE 0x0006
+#define IPC_SYS_GETPROFILE 0x0007
+#define IPC_SYS_GETMEM2 0x0008
 #define IPC_SYS_WRITE32	0x0100
 #define IPC_SYS_WRITE16	0x0101
 #define IPC_SYS_WRITE8	0x0102
@@ -128,12 +133,13 @@ typedef const struct {
 	u32 ipc_in_size;
 	volatile ipc_request *ipc_out;
 	u32 ipc_out_size;
+	void *log_ring; // log_shm from gecko.h, NULL if not built in
 } ipc_infohdr;
 
 void ipc_irq(void);
 
-void ipc_initialize(void);
-void ipc_shutdown(void);
+void ipc_initialize(void) COLD;
+void ipc_shutdown(void) COLD;
 void ipc_post(u32 code, u32 tag, u32 num_args, ...);
 void ipc_flush(void);
 u32  ipc_process_slow(void);
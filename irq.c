@@ -18,6 +18,7 @@ Copyright (C) 2009			Andre Heider "dhewg" <dhewg@wiibrew.org>
 #include "crypto.h"
 #include "nand.h"
 #include "sdhc.h"
+#include "profile.h"
 
 static u32 _alarm_frequency = 0;
 
@@ -44,7 +45,8 @@ void irq_shutdown(void)
 	irq_kill();
 }
 
-void irq_handler(void)
+// pc is the address of the instruction the IRQ interrupted, see v_irq
+void irq_handler(u32 pc)
 {
 	u32 enabled = read32(HW_ARMIRQMASK);
 	u32 flags = read32(HW_ARMIRQFLAG);
@@ -58,6 +60,8 @@ void irq_handler(void)
 			write32(HW_ALARM, read32(HW_TIMER) + _alarm_frequency);
 
 		write32(HW_ARMIRQFLAG, IRQF_TIMER);
+		profile_sample(pc);
+		sdhc_async_timeout();
 	}
 	if(flags & IRQF_NAND) {
 //		gecko_printf("IRQ: NAND\n");
@@ -119,3 +123,8 @@ void irq_set_alarm(u32 ms, u8 enable)
 		write32(HW_ALARM, read32(HW_TIMER) + _alarm_frequency);
 }
 
+u32 irq_get_alarm(void)
+{
+	return _alarm_frequency / IRQ_ALARM_MS2REG(1);
+}
+
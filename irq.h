@@ -48,11 +48,12 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #ifndef _LANGUAGE_ASSEMBLY
 
 #include "types.h"
+#include "hollywood.h"
 
-#define IRQ_ALARM_MS2REG(x)	(1898 * x)
+#define IRQ_ALARM_MS2REG(x)	HW_TIMER_MS2TICKS(x)
 
-void irq_initialize(void);
-void irq_shutdown(void);
+void irq_initialize(void) COLD;
+void irq_shutdown(void) COLD;
 
 void irq_enable(u32 irq);
 void irq_disable(u32 irq);
@@ -67,6 +68,7 @@ static inline void irq_wait(void)
 }
 
 void irq_set_alarm(u32 ms, u8 enable);
+u32 irq_get_alarm(void);
 #endif
 
 #else
@@ -0,0 +1,255 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	LZ4 frame decompression
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "types.h"
+#include "string.h"
+#include "ff.h"
+#include "lz4.h"
+#include "mem2.h"
+
+#define FLG_VERSION_MASK	0xC0
+#define FLG_VERSION			0x40
+#define FLG_BLOCK_INDEP		0x20
+#define FLG_BLOCK_CHECKSUM	0x10
+#define FLG_CONTENT_SIZE	0x08
+#define FLG_DICT_ID			0x01
+#define BD_BLOCK_64K		0x40
+
+#define BLOCK_UNCOMPRESSED	0x80000000
+
+// compressed input and decompressed output of the current block, only
+// taken from the MEM2 arena once a compressed payload shows up
+static u8 *lz4_in;
+static u8 *lz4_out;
+
+static u32 _le32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+// Decodes one LZ4 block and returns the number of bytes written to dst,
+// or LZ4_ECORRUPT if it would read or write out of bounds.
+int lz4_decompress(const u8 *src, u32 srclen, u8 *dst, u32 dstlen)
+{
+	const u8 *ip = src, *iend = src + srclen;
+	u8 *op = dst, *oend = dst + dstlen;
+	const u8 *match;
+	u32 token, len, off, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return LZ4_ECORRUPT;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		if (len > (u32)(iend - ip) || len > (u32)(oend - op))
+			return LZ4_ECORRUPT;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+
+		// the last sequence has literals only
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return LZ4_ECORRUPT;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (off == 0 || off > (u32)(op - dst))
+			return LZ4_ECORRUPT;
+
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return LZ4_ECORRUPT;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += 4;
+		if (len > (u32)(oend - op))
+			return LZ4_ECORRUPT;
+
+		// may overlap its own output, so this has to go bytewise
+		match = op - off;
+		while (len--)
+			*op++ = *match++;
+	}
+
+	return op - dst;
+}
+
+int lz4_open(lz4_stream *s, FIL *fd)
+{
+	u8 hdr[2 + 8 + 4 + 1];
+	u32 len, read;
+	FRESULT fres;
+
+	if (!lz4_in)
+		lz4_in = mem2_alloc(LZ4_BLOCK_MAX, MEM2_ALIGN_LINE);
+	if (!lz4_out)
+		lz4_out = mem2_alloc(LZ4_BLOCK_MAX, MEM2_ALIGN_LINE);
+	if (!lz4_in || !lz4_out)
+		return LZ4_ENOMEM;
+
+	s->fd = fd;
+	s->pos = 0;
+	s->avail = 0;
+	s->next = lz4_out;
+	s->eof = 0;
+
+	fres = f_read(fd, hdr, 2, &read);
+	if (fres != FR_OK)
+		return -fres;
+	if (read != 2)
+		return LZ4_EFORMAT;
+
+	s->flags = hdr[0];
+	if ((s->flags & FLG_VERSION_MASK) != FLG_VERSION)
+		return LZ4_EFORMAT;
+	// the block buffers only hold 64KB and there is no room to keep the
+	// previous block around as a dictionary
+	if (!(s->flags & FLG_BLOCK_INDEP) || (hdr[1] & 0x70) != BD_BLOCK_64K)
+		return LZ4_EFORMAT;
+
+	// optional content size and dictionary id, then the header checksum
+	len = 1;
+	if (s->flags & FLG_CONTENT_SIZE)
+		len += 8;
+	if (s->flags & FLG_DICT_ID)
+		len += 4;
+	fres = f_read(fd, hdr + 2, len, &read);
+	if (fres != FR_OK)
+		return -fres;
+	if (read != len)
+		return LZ4_EFORMAT;
+
+	return 0;
+}
+
+// Fetches the next block. Big enough reads pass a destination of at least
+// LZ4_BLOCK_MAX bytes in dst so the block lands there without the extra
+// copy; otherwise it goes to lz4_out. Returns the decompressed size.
+static int _next_block(lz4_stream *s, u8 *dst)
+{
+	u8 word[4];
+	u32 size, read;
+	FRESULT fres;
+	int res;
+
+	fres = f_read(s->fd, word, 4, &read);
+	if (fres != FR_OK)
+		return -fres;
+	if (read != 4)
+		return LZ4_ECORRUPT;
+
+	size = _le32(word);
+	if (size == 0) {
+		// end mark; the content checksum after it is not checked
+		s->eof = 1;
+		return 0;
+	}
+
+	if (!dst)
+		dst = lz4_out;
+
+	if (size & BLOCK_UNCOMPRESSED) {
+		size &= ~BLOCK_UNCOMPRESSED;
+		if (size > LZ4_BLOCK_MAX)
+			return LZ4_ECORRUPT;
+		fres = f_read(s->fd, dst, size, &read);
+		res = size;
+	} else {
+		if (size > LZ4_BLOCK_MAX)
+			return LZ4_ECORRUPT;
+		fres = f_read(s->fd, lz4_in, size, &read);
+		res = 0;
+	}
+	if (fres != FR_OK)
+		return -fres;
+	if (read != size)
+		return LZ4_ECORRUPT;
+
+	if (s->flags & FLG_BLOCK_CHECKSUM) {
+		fres = f_read(s->fd, word, 4, &read);
+		if (fres != FR_OK)
+			return -fres;
+	}
+
+	if (!res)
+		res = lz4_decompress(lz4_in, size, dst, LZ4_BLOCK_MAX);
+	return res;
+}
+
+int lz4_read(lz4_stream *s, void *dst, u32 len, u32 *read)
+{
+	u8 *out = dst;
+	u32 n;
+	int res;
+
+	*read = 0;
+	while (len) {
+		if (!s->avail) {
+			if (s->eof)
+				break;
+			if (out && len >= LZ4_BLOCK_MAX) {
+				res = _next_block(s, out);
+				if (res < 0)
+					return res;
+				out += res;
+				len -= res;
+				s->pos += res;
+				*read += res;
+				continue;
+			}
+			res = _next_block(s, NULL);
+			if (res < 0)
+				return res;
+			s->next = lz4_out;
+			s->avail = res;
+			continue;
+		}
+
+		n = len < s->avail ? len : s->avail;
+		if (out) {
+			memcpy(out, s->next, n);
+			out += n;
+		}
+		s->next += n;
+		s->avail -= n;
+		s->pos += n;
+		len -= n;
+		*read += n;
+	}
+
+	return 0;
+}
+
+// only forward, by decompressing and dropping everything up to pos
+int lz4_seek(lz4_stream *s, u32 pos)
+{
+	u32 read;
+	int res;
+
+	if (pos < s->pos)
+		return LZ4_ESEEK;
+	res = lz4_read(s, NULL, pos - s->pos, &read);
+	if (res < 0)
+		return res;
+	if (s->pos != pos)
+		return LZ4_ECORRUPT;
+	return 0;
+}
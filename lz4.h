@@ -0,0 +1,42 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	LZ4 frame decompression
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __LZ4_H__
+#define __LZ4_H__
+
+#include "types.h"
+#include "ff.h"
+
+#define LZ4_MAGIC		0x184D2204 // stored little endian
+#define LZ4_BLOCK_MAX	0x10000
+
+// errors, kept clear of the -100.. codes used by the PPC loaders
+#define LZ4_EFORMAT		-120 // not a frame we can decode
+#define LZ4_ECORRUPT	-121 // bad block data
+#define LZ4_ESEEK		-122 // backwards seek in a compressed stream
+#define LZ4_ENOMEM		-123 // no MEM2 left for the block buffers
+
+// Decodes frames made with "lz4 -B4": independent blocks of at most 64KB.
+// Checksums in the frame are skipped, not verified.
+typedef struct {
+	FIL *fd;
+	u32 pos;		// offset in the decompressed data
+	u32 avail;		// decompressed bytes left in the block buffer
+	u8 *next;		// first of them
+	u8 flags;
+	u8 eof;
+} lz4_stream;
+
+int lz4_decompress(const u8 *src, u32 srclen, u8 *dst, u32 dstlen);
+
+// fd must be positioned just past the magic
+int lz4_open(lz4_stream *s, FIL *fd);
+int lz4_read(lz4_stream *s, void *dst, u32 len, u32 *read);
+int lz4_seek(lz4_stream *s, u32 pos);
+
+#endif
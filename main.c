@@ -31,7 +31,7 @@ Copyright (C) 2009		John Kelley <wiidev@kelley.ca>
 
 #define PPC_BOOT_FILE "/bootmii/ppcboot.elf"
 
-FATFS fatfs;
+FATFS fatfs MEM2_BSS ALIGNED(32);
 
 u32 _main(void *base)
 {	sensorPrep();
@@ -81,6 +81,9 @@ u32 _main(void *base)
 
 	gecko_printf("Mounting SD...\n");
 	fres = f_mount(0, &fatfs);
+	// the log only drains from the IPC loop; get the boot so far onto
+	// the card in case it never gets there
+	gecko_log_sync();
 
 	if (read32(0x0d800190) & 2) {
 		gecko_printf("GameCube compatibility mode detected...\n");
@@ -95,6 +98,7 @@ u32 _main(void *base)
 
 	
 
+	gecko_log_sync();
 	if(read32(0x01200004) == 0x016AE570)
 	{	gecko_printf("Trying to boot:%s\n", (char*)0x01200008);
 		res = powerpc_boot_file((char*)0x01200008);
@@ -103,6 +107,7 @@ u32 _main(void *base)
 	{	gecko_printf("Trying to boot:" PPC_BOOT_FILE "\n");
 		res = powerpc_boot_file(PPC_BOOT_FILE);
 	}
+	gecko_log_sync();
 	if(res < 0) {
 		gecko_printf("Failed to boot PPC: %d\n", res);
 		gecko_printf("Booting System Menu\n");
@@ -118,6 +123,8 @@ u32 _main(void *base)
 
 shutdown:
 	gecko_printf("Shutting down interrupts...\n");
+	gecko_log_flush();
+	gecko_log_close();
 	irq_shutdown();
 	gecko_printf("Shutting down caches and MMU...\n");
 	mem_shutdown();
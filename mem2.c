@@ -0,0 +1,80 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	MEM2 arena allocator
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#include "types.h"
+#include "string.h"
+#include "irq.h"
+#include "gecko.h"
+#include "memory.h"
+#include "mem2.h"
+
+// whatever mini.ld leaves of the mem2 region after the static data
+extern u8 __mem2_heap_start[], __mem2_heap_end[];
+
+static u8 *mem2_next;
+static mem2_stats stats;
+
+// Forgets every allocation. Nothing handed out before may be used
+// afterwards; mem_initialize and mem_shutdown call this.
+void mem2_reset(void)
+{
+	u32 cookie = irq_kill();
+
+	mem2_next = __mem2_heap_start;
+	memset(&stats, 0, sizeof(stats));
+	stats.magic = MEM2_STATS_MAGIC;
+	stats.base = (u32)__mem2_heap_start;
+	stats.size = __mem2_heap_end - __mem2_heap_start;
+
+	irq_restore(cookie);
+}
+
+// Bump allocates size bytes aligned to align (a power of two). Blocks are
+// only given back by mem2_reset(). Line aligned blocks are also padded to
+// whole lines, so invalidating one for DMA never hits its neighbour.
+void *mem2_alloc(u32 size, u32 align)
+{
+	u32 cookie;
+	u8 *p;
+
+	if (align < 4)
+		align = 4;
+	if (align >= MEM2_ALIGN_LINE)
+		size = ALIGN_FORWARD(size, MEM2_ALIGN_LINE);
+
+	cookie = irq_kill();
+	p = ALIGN_FORWARD(mem2_next, align);
+	if (p > __mem2_heap_end || size > (u32)(__mem2_heap_end - p)) {
+		stats.failed++;
+		irq_restore(cookie);
+		gecko_printf("MEM2: alloc(0x%x) failed, 0x%x of 0x%x used\n",
+				size, stats.used, stats.size);
+		return NULL;
+	}
+	mem2_next = p + size;
+	stats.used = mem2_next - __mem2_heap_start;
+	stats.allocs++;
+	irq_restore(cookie);
+
+	return p;
+}
+
+// Copies the arena statistics. Returns the number of bytes written.
+u32 mem2_copy_stats(void *buf, u32 size)
+{
+	u32 cookie;
+
+	if (size < sizeof(stats))
+		return 0;
+
+	cookie = irq_kill();
+	memcpy(buf, &stats, sizeof(stats));
+	irq_restore(cookie);
+
+	return sizeof(stats);
+}
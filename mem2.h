@@ -0,0 +1,35 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	MEM2 arena allocator
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __MEM2_H__
+#define __MEM2_H__
+
+#include "types.h"
+
+#define MEM2_STATS_MAGIC	0x4d454d32 // "MEM2"
+
+// alignments for mem2_alloc()
+#define MEM2_ALIGN_LINE		32	// cache line, for buffers that see DMA
+#define MEM2_ALIGN_128		128	// NAND spare/ECC buffers
+
+// returned by IPC_SYS_GETMEM2
+typedef struct {
+	u32 magic;
+	u32 base;		// start of the arena
+	u32 size;		// arena size in bytes
+	u32 used;		// bytes handed out, including alignment padding
+	u32 allocs;		// successful mem2_alloc() calls
+	u32 failed;		// mem2_alloc() calls that did not fit
+} mem2_stats;
+
+void mem2_reset(void);
+void *mem2_alloc(u32 size, u32 align);
+
+u32 mem2_copy_stats(void *buf, u32 size);
+
+#endif
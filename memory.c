@@ -15,6 +15,7 @@ Copyright (C) 2008, 2009	Hector Martin "marcan" <marcan@marcansoft.com>
 #include "gecko.h"
 #include "hollywood.h"
 #include "irq.h"
+#include "mem2.h"
 
 void _dc_inval_entries(void *start, int count);
 void _dc_flush_entries(const void *start, int count);
@@ -24,6 +25,8 @@ void _drain_write_buffer(void);
 
 #ifndef LOADER
 extern u32 __page_table[4096];
+extern u8 __dma_area_start[], __dma_area_end[];
+extern u8 __mem2_area_start[];
 void _dc_inval(void);
 void _tlb_inval(void);
 #endif
@@ -204,29 +207,68 @@ done:
 	irq_restore(cookie);
 }
 
-void dc_flushrange(const void *start, u32 size)
+void dc_batch_begin(dc_batch *b)
 {
-	u32 cookie = irq_kill();
-	if(size > 0x4000) {
+	b->cookie = irq_kill();
+	b->flushed = 0;
+	b->flush = 0;
+	b->inval = 0;
+	b->all = 0;
+}
+
+void dc_batch_flush(dc_batch *b, const void *start, u32 size)
+{
+	b->flush = 1;
+	if(b->all || MEM2_IS_UNCACHED(start))
+		return;
+	b->flushed += size;
+	if(b->flushed > CACHESIZE) {
 		_dc_flush();
+		b->all = 1;
 	} else {
 		void *end = ALIGN_FORWARD(((u8*)start) + size, LINESIZE);
 		start = ALIGN_BACKWARD(start, LINESIZE);
 		_dc_flush_entries(start, (end - start) / LINESIZE);
 	}
-	_drain_write_buffer();
-	ahb_flush_from(AHB_1);
-	irq_restore(cookie);
 }
 
-void dc_invalidaterange(void *start, u32 size)
+void dc_batch_invalidate(dc_batch *b, void *start, u32 size)
 {
-	u32 cookie = irq_kill();
+	if(MEM2_IS_UNCACHED(start))
+		return;
 	void *end = ALIGN_FORWARD(((u8*)start) + size, LINESIZE);
 	start = ALIGN_BACKWARD(start, LINESIZE);
 	_dc_inval_entries(start, (end - start) / LINESIZE);
-	ahb_flush_to(AHB_STARLET);
-	irq_restore(cookie);
+	b->inval = 1;
+}
+
+void dc_batch_end(dc_batch *b)
+{
+	if(b->flush) {
+		_drain_write_buffer();
+		ahb_flush_from(AHB_1);
+	}
+	if(b->inval)
+		ahb_flush_to(AHB_STARLET);
+	irq_restore(b->cookie);
+}
+
+void dc_flushrange(const void *start, u32 size)
+{
+	dc_batch b;
+
+	dc_batch_begin(&b);
+	dc_batch_flush(&b, start, size);
+	dc_batch_end(&b);
+}
+
+void dc_invalidaterange(void *start, u32 size)
+{
+	dc_batch b;
+
+	dc_batch_begin(&b);
+	dc_batch_invalidate(&b, start, size);
+	dc_batch_end(&b);
 }
 
 void dc_flushall(void)
@@ -238,6 +280,15 @@ void dc_flushall(void)
 	irq_restore(cookie);
 }
 
+// makes writes through MEM2_UNCACHED visible to other bus masters
+void dc_drain(void)
+{
+	u32 cookie = irq_kill();
+	_drain_write_buffer();
+	ahb_flush_from(AHB_1);
+	irq_restore(cookie);
+}
+
 void ic_invalidateall(void)
 {
 	u32 cookie = irq_kill();
@@ -279,17 +330,41 @@ u32 dma_addr(void *p)
 			addr &= 0x0001FFFF;
 			addr |= 0x0d400000;
 			break;
+		case (MEM2_UNCACHED_BASE>>20) ... (MEM2_UNCACHED_BASE>>20) + 0x3f:
+			addr -= MEM2_UNCACHED_OFFSET;
+			break;
 	}
 	//gecko_printf("DMA to %p: address %08x\n", p, addr);
 	return addr;
 }
 
+// Hands out never freed DMA buffers from the dma area reserved in mini.ld,
+// as pointers into the uncached MEM2 window. Meant for init time, so
+// drivers own their buffers for as long as mini runs.
+void *dma_alloc(u32 size, u32 align)
+{
+	static u8 *dma_next = __dma_area_start;
+	u8 *p;
+
+	if(align < LINESIZE)
+		align = LINESIZE;
+	p = ALIGN_FORWARD(dma_next, align);
+	if(p + size > __dma_area_end) {
+		gecko_printf("MEM: dma_alloc(0x%x) failed, area exhausted\n", size);
+		return NULL;
+	}
+	// keep the next buffer off this one's last line
+	dma_next = ALIGN_FORWARD(p + size, LINESIZE);
+	return mem2_uncached(p);
+}
+
 #define SECTION				0x012
+#define COARSE				0x011
+#define LARGE_PAGE			0x001
+#define SMALL_PAGE			0x002
 
-#define	NONBUFFERABLE		0x000
-#define	BUFFERABLE			0x004
-#define	WRITETHROUGH_CACHE	0x008
-#define	WRITEBACK_CACHE		0x00C
+#define PAGE_CACHE_MASK		0x00C
+#define PAGE_AP_RWUSER		0xFF0
 
 #define DOMAIN(x)			((x)<<5)
 
@@ -307,6 +382,71 @@ void map_section(u32 from, u32 to, u32 size, u32 attributes)
 	}
 }
 
+// second level table for mini's own 1MB of MEM2, so its DMA area, queues
+// and buffers can get their own cache policy
+static u32 mem2_pages[256] MEM2_BSS ALIGNED(1024);
+
+// from: units of 1MB; points the section at a coarse table of 4KB pages
+// that map it 1:1 with the cache policy and domain from attributes
+void map_coarse(u32 from, u32 *table, u32 attributes)
+{
+	int i;
+
+	for(i = 0; i < 256; i++)
+		table[i] = (from<<20) | (i<<12) | (attributes & PAGE_CACHE_MASK) |
+			PAGE_AP_RWUSER | SMALL_PAGE;
+	__page_table[from] = (u32)table | (attributes & DOMAIN(0xf)) | COARSE;
+}
+
+// from, to, size: bytes, 4KB aligned, and only inside sections that went
+// through map_coarse(). Uses 64KB pages wherever both sides line up. With
+// the MMU on, the range is written back and dropped from the cache first,
+// so nothing else may touch it until this returns.
+int map_pages(u32 from, u32 to, u32 size, u32 cache)
+{
+	u32 end = from + size;
+	u32 l1, step, i, n;
+	u32 *table;
+	int mmu = get_cr() & CR_MMU;
+
+	if((from | to | size) & 0xfff)
+		return -1;
+
+	if(mmu) {
+		dc_flushrange((void *)from, size);
+		dc_invalidaterange((void *)from, size);
+	}
+
+	while(from < end) {
+		l1 = __page_table[from >> 20];
+		if((l1 & 3) != (COARSE & 3)) {
+			gecko_printf("MEM: 0x%08x is not mapped with pages\n", from);
+			return -1;
+		}
+		table = (u32 *)(l1 & ~0x3ff);
+		i = (from >> 12) & 0xff;
+
+		if(!((from | to) & 0xffff) && end - from >= 0x10000) {
+			for(n = 0; n < 16; n++)
+				table[i + n] = to | cache | PAGE_AP_RWUSER | LARGE_PAGE;
+			step = 0x10000;
+		} else {
+			table[i] = to | cache | PAGE_AP_RWUSER | SMALL_PAGE;
+			step = 0x1000;
+		}
+		// the table walk reads memory, not the data cache
+		if(mmu)
+			dc_flushrange(&table[i], step >> 10);
+
+		from += step;
+		to += step;
+	}
+
+	if(mmu)
+		_tlb_inval();
+	return 0;
+}
+
 //#define NO_CACHES
 
 void mem_initialize(void)
@@ -327,9 +467,16 @@ void mem_initialize(void)
 	gecko_printf("MEM: mapping sections\n");
 
 	memset32(__page_table, 0, 16384);
+	mem2_reset();
 
 	map_section(0x000, 0x000, 0x018, WRITEBACK_CACHE | DOMAIN(0) | AP_RWUSER);
 	map_section(0x100, 0x100, 0x040, WRITEBACK_CACHE | DOMAIN(0) | AP_RWUSER);
+	map_section(MEM2_UNCACHED_BASE>>20, 0x100, 0x040, BUFFERABLE | DOMAIN(0) | AP_RWUSER);
+	// mini's MEM2 goes through 4KB pages; the DMA area is kept out of the
+	// cache at both of its addresses
+	map_coarse((u32)__mem2_area_start >> 20, mem2_pages, WRITEBACK_CACHE | DOMAIN(0) | AP_RWUSER);
+	map_pages((u32)__dma_area_start, (u32)__dma_area_start,
+		__dma_area_end - __dma_area_start, BUFFERABLE);
 	map_section(0x0d0, 0x0d0, 0x001, NONBUFFERABLE | DOMAIN(0) | AP_RWUSER);
 	map_section(0x0d8, 0x0d8, 0x001, NONBUFFERABLE | DOMAIN(0) | AP_RWUSER);
 	map_section(0xfff, 0xfff, 0x001, WRITEBACK_CACHE | DOMAIN(0) | AP_RWUSER);
@@ -369,6 +516,7 @@ void mem_shutdown(void)
 	_ic_inval();
 	_dc_inval();
 	_tlb_inval();
+	mem2_reset();
 	irq_restore(cookie);
 }
 #endif
@@ -19,6 +19,19 @@ Copyright (C) 2008, 2009	Hector Martin "marcan" <marcan@marcansoft.com>
 #define ALIGN_BACKWARD(x,align) \
 	((typeof(x))(((u32)(x)) & (~(align-1))))
 
+// MEM2 is mapped a second time at MEM2_UNCACHED_BASE, uncached but write
+// buffered. Memory only ever touched through that window needs no cache
+// lines cleaned or invalidated around DMA: dc_batch skips such ranges and
+// a clean only costs the write buffer drain and the AHB flush.
+#define MEM2_UNCACHED_BASE	0x20000000
+#define MEM2_UNCACHED_OFFSET	(MEM2_UNCACHED_BASE - 0x10000000)
+#define MEM2_IS_UNCACHED(p)	(((u32)(p) >> 26) == (MEM2_UNCACHED_BASE >> 26))
+
+static inline void *mem2_uncached(const volatile void *p)
+{
+	return (void *)((u32)p + MEM2_UNCACHED_OFFSET);
+}
+
 enum AHBDEV {
 	AHB_STARLET = 0, //or MEM2 or some controller or bus or ??
 	AHB_1 = 1, //ppc or something else???
@@ -28,19 +41,46 @@ enum AHBDEV {
 	AHB_SDHC = 9,
 };
 
+// Collects cache maintenance for several ranges and pays for the write
+// buffer drain and AHB handshakes once in dc_batch_end(). Cleans that add
+// up to more than the cache size turn into a single whole-cache clean.
+// IRQs stay disabled between begin and end.
+typedef struct {
+	u32 cookie;
+	u32 flushed;
+	u8 flush;
+	u8 inval;
+	u8 all;
+} dc_batch;
+
+void dc_batch_begin(dc_batch *b);
+void dc_batch_flush(dc_batch *b, const void *start, u32 size);
+void dc_batch_invalidate(dc_batch *b, void *start, u32 size);
+void dc_batch_end(dc_batch *b);
+
 void dc_flushrange(const void *start, u32 size);
 void dc_invalidaterange(void *start, u32 size);
 void dc_flushall(void);
+void dc_drain(void);
 void ic_invalidateall(void);
 void ahb_flush_from(enum AHBDEV dev);
 void ahb_flush_to(enum AHBDEV dev);
 void mem_protect(int enable, void *start, void *end);
 void mem_setswap(int enable);
 
-void mem_initialize(void);
-void mem_shutdown(void);
+void mem_initialize(void) COLD;
+void mem_shutdown(void) COLD;
 
 u32 dma_addr(void *);
+void *dma_alloc(u32 size, u32 align);
+
+// cache policies for map_pages()
+#define	NONBUFFERABLE		0x000
+#define	BUFFERABLE			0x004
+#define	WRITETHROUGH_CACHE	0x008
+#define	WRITEBACK_CACHE		0x00C
+
+int map_pages(u32 from, u32 to, u32 size, u32 cache);
 
 static inline u32 get_cr(void)
 {
@@ -0,0 +1,32 @@
+#!/usr/bin/env python
+
+# Writes the SHA-1 manifest powerpc_elf.c checks a PPC payload against:
+# the magic "SHA1", the number of program headers, then the SHA-1 of each
+# one's file bytes in program header order (headers that are not PT_LOAD
+# still get a slot). The manifest must sit next to the payload with the
+# same name and a .sha extension, e.g. /bootmii/ppcboot.sha.
+#
+# usage: mkmanifest.py ppcboot.elf ppcboot.sha
+
+import sys, struct, hashlib
+
+if len(sys.argv) != 3:
+	print("Usage: %s <payload.elf> <payload.sha>" % sys.argv[0])
+	sys.exit(1)
+
+data = open(sys.argv[1], "rb").read()
+if data[:6] != b"\x7fELF\x01\x02":
+	print("%s is not a 32-bit big-endian ELF" % sys.argv[1])
+	sys.exit(1)
+
+phoff, = struct.unpack(">I", data[0x1c:0x20])
+phentsize, phnum = struct.unpack(">HH", data[0x2a:0x2e])
+
+out = struct.pack(">II", 0x53484131, phnum)
+for i in range(phnum):
+	off = phoff + i * phentsize
+	p_offset, = struct.unpack(">I", data[off + 4:off + 8])
+	p_filesz, = struct.unpack(">I", data[off + 16:off + 20])
+	out += hashlib.sha1(data[p_offset:p_offset + p_filesz]).digest()
+
+open(sys.argv[2], "wb").write(out)
@@ -20,6 +20,8 @@ Copyright (C) 2008, 2009	Hector Martin "marcan" <marcan@marcansoft.com>
 #include "irq.h"
 #include "ipc.h"
 #include "gecko.h"
+#include "trace.h"
+#include "mem2.h"
 #include "types.h"
 
 // #define	NAND_DEBUG	1
@@ -54,8 +56,15 @@ Copyright (C) 2008, 2009	Hector Martin "marcan" <marcan@marcansoft.com>
 
 static ipc_request current_request;
 
-static u8 ipc_data[PAGE_SIZE] MEM2_BSS ALIGNED(32);
-static u8 ipc_ecc[ECC_BUFFER_ALLOC] MEM2_BSS ALIGNED(128); //128 alignment REQUIRED
+// taken from the MEM2 arena by nand_initialize
+static u8 *ipc_data;
+static u8 *ipc_ecc;
+#ifdef NAND_SUPPORT_WRITE
+// pages on their way out are only written by the ARM, so they live in the
+// uncached MEM2 window and skip the cache clean per page
+static u8 *write_data;
+static u8 *write_ecc;
+#endif
 
 static volatile int irq_flag;
 static u32 last_page_read = 0;
@@ -63,6 +72,7 @@ static u32 nand_min_page = 0x200; // default to protecting boot1+boot2
 
 void nand_irq(void)
 {
+	dc_batch b;
 	int code, tag, err = 0;
 	if(read32(NAND_CMD) & NAND_ERROR) {
 		gecko_printf("NAND: Error on IRQ\n");
@@ -71,25 +81,26 @@ void nand_irq(void)
 	ahb_flush_from(AHB_NAND);
 	ahb_flush_to(AHB_STARLET);
 	if (current_request.code != 0) {
+		dc_batch_begin(&b);
 		switch (current_request.req) {
 			case IPC_NAND_GETID:
 				memcpy32((void*)current_request.args[0], ipc_data, 0x40);
-				dc_flushrange((void*)current_request.args[0], 0x40);
+				dc_batch_flush(&b, (void*)current_request.args[0], 0x40);
 				break;
 			case IPC_NAND_STATUS:
 				memcpy32((void*)current_request.args[0], ipc_data, 0x40);
-				dc_flushrange((void*)current_request.args[0], 0x40);
+				dc_batch_flush(&b, (void*)current_request.args[0], 0x40);
 				break;
 			case IPC_NAND_READ:
 				err = nand_correct(last_page_read, ipc_data, ipc_ecc);
 
 				if (current_request.args[1] != 0xFFFFFFFF) {
 					memcpy32((void*)current_request.args[1], ipc_data, PAGE_SIZE);
-					dc_flushrange((void*)current_request.args[1], PAGE_SIZE);
+					dc_batch_flush(&b, (void*)current_request.args[1], PAGE_SIZE);
 				}
 				if (current_request.args[2] != 0xFFFFFFFF) {
 					memcpy32((void*)current_request.args[2], ipc_ecc, PAGE_SPARE_SIZE);
-					dc_flushrange((void*)current_request.args[2], PAGE_SPARE_SIZE);
+					dc_batch_flush(&b, (void*)current_request.args[2], PAGE_SPARE_SIZE);
 				}
 				break;
 			case IPC_NAND_ERASE:
@@ -101,6 +112,7 @@ void nand_irq(void)
 			default:
 				gecko_printf("Got IRQ for unknown NAND req %d\n", current_request.req);
 		}
+		dc_batch_end(&b);
 		code = current_request.code;
 		tag = current_request.tag;
 		current_request.code = 0;
@@ -178,13 +190,17 @@ void nand_get_status(u8 *status_buf) {
 }
 
 void nand_read_page(u32 pageno, void *data, void *ecc) {
+	dc_batch b;
+
 	irq_flag = 0;
 	last_page_read = pageno;  // needed for error reporting
 	__nand_set_address(0, pageno);
 	nand_send_command(NAND_READ_PRE, 0x1f, 0, 0);
 
-	if (((s32)data) != -1) dc_invalidaterange(data, PAGE_SIZE);
-	if (((s32)ecc) != -1)  dc_invalidaterange(ecc, ECC_BUFFER_SIZE);
+	dc_batch_begin(&b);
+	if (((s32)data) != -1) dc_batch_invalidate(&b, data, PAGE_SIZE);
+	if (((s32)ecc) != -1)  dc_batch_invalidate(&b, ecc, ECC_BUFFER_SIZE);
+	dc_batch_end(&b);
 
 	__nand_wait();
 	__nand_setup_dma(data, ecc);
@@ -203,6 +219,8 @@ void nand_wait(void) {
 
 #ifdef NAND_SUPPORT_WRITE
 void nand_write_page(u32 pageno, void *data, void *ecc) {
+	dc_batch b;
+
 	irq_flag = 0;
 	NAND_debug("nand_write_page(%u, %p, %p)\n", pageno, data, ecc);
 
@@ -211,8 +229,10 @@ void nand_write_page(u32 pageno, void *data, void *ecc) {
 		gecko_printf("Error: nand_write to page %d forbidden\n", pageno);
 		return;
 	}
-	if (((s32)data) != -1) dc_flushrange(data, PAGE_SIZE);
-	if (((s32)ecc) != -1)  dc_flushrange(ecc, PAGE_SPARE_SIZE);
+	dc_batch_begin(&b);
+	if (((s32)data) != -1) dc_batch_flush(&b, data, PAGE_SIZE);
+	if (((s32)ecc) != -1)  dc_batch_flush(&b, ecc, PAGE_SPARE_SIZE);
+	dc_batch_end(&b);
 	ahb_flush_to(AHB_NAND);
 	__nand_set_address(0, pageno);
 	__nand_setup_dma(data, ecc);
@@ -243,6 +263,21 @@ void nand_erase_block(u32 pageno) {
 void nand_initialize(void)
 {
 	current_request.code = 0;
+	ipc_data = mem2_alloc(PAGE_SIZE, MEM2_ALIGN_LINE);
+	ipc_ecc = mem2_alloc(ECC_BUFFER_ALLOC, MEM2_ALIGN_128); //128 alignment REQUIRED
+	if (!ipc_data || !ipc_ecc) {
+		ipc_data = NULL;
+		gecko_printf("NAND: no MEM2 left for the IPC buffers\n");
+		return;
+	}
+#ifdef NAND_SUPPORT_WRITE
+	write_data = dma_alloc(PAGE_SIZE, 32);
+	write_ecc = dma_alloc(ECC_BUFFER_ALLOC, 128);
+	if (!write_data || !write_ecc) {
+		write_data = ipc_data;
+		write_ecc = ipc_ecc;
+	}
+#endif
 	nand_reset();
 	irq_enable(IRQ_NAND);
 }
@@ -284,7 +319,7 @@ int nand_correct(u32 pageno, void *data, void *ecc)
 		ecc_calc++;
 	}
 	if(uncorrectable || corrected)
-		gecko_printf("ECC stats for NAND page 0x%x: %d uncorrectable, %d corrected\n", pageno, uncorrectable, corrected);
+		TRACE("ECC stats for NAND page 0x%x: %d uncorrectable, %d corrected\n", pageno, uncorrectable, corrected);
 	if(uncorrectable)
 		return NAND_ECC_UNCORRECTABLE;
 	if(corrected)
@@ -294,12 +329,19 @@ int nand_correct(u32 pageno, void *data, void *ecc)
 
 void nand_ipc(volatile ipc_request *req)
 {
+#ifdef NAND_SUPPORT_WRITE
+	dc_batch b;
+#endif
 	u32 new_min_page = 0x200;
 	if (current_request.code != 0) {
 		gecko_printf("NAND: previous IPC request is not done yet.");
 		ipc_post(req->code, req->tag, 1, -1);
 		return;
 	}
+	if (!ipc_data) {
+		ipc_post(req->code, req->tag, 1, -1);
+		return;
+	}
 	switch (req->req) {
 		case IPC_NAND_RESET:
 			nand_reset();
@@ -323,11 +365,13 @@ void nand_ipc(volatile ipc_request *req)
 #ifdef NAND_SUPPORT_WRITE
 		case IPC_NAND_WRITE:
 			current_request = *req;
-			dc_invalidaterange((void*)req->args[1], PAGE_SIZE);
-			dc_invalidaterange((void*)req->args[2], PAGE_SPARE_SIZE);
-			memcpy(ipc_data, (void*)req->args[1], PAGE_SIZE);
-			memcpy(ipc_ecc, (void*)req->args[2], PAGE_SPARE_SIZE);
-			nand_write_page(req->args[0], ipc_data, ipc_ecc);
+			dc_batch_begin(&b);
+			dc_batch_invalidate(&b, (void*)req->args[1], PAGE_SIZE);
+			dc_batch_invalidate(&b, (void*)req->args[2], PAGE_SPARE_SIZE);
+			dc_batch_end(&b);
+			memcpy(write_data, (void*)req->args[1], PAGE_SIZE);
+			memcpy(write_ecc, (void*)req->args[2], PAGE_SPARE_SIZE);
+			nand_write_page(req->args[0], write_data, write_ecc);
 			break;
 #endif
 #ifdef NAND_SUPPORT_ERASE
@@ -38,7 +38,7 @@ void nand_wait(void);
 #define NAND_ECC_UNCORRECTABLE -1
 
 int nand_correct(u32 pageno, void *data, void *ecc);
-void nand_initialize(void);
+void nand_initialize(void) COLD;
 void nand_ipc(volatile ipc_request *req);
 
 #endif
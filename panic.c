@@ -12,12 +12,33 @@ Copyright (C) 2008, 2009	Hector Martin "marcan" <marcan@marcansoft.com>
 #include "utils.h"
 #include "start.h"
 #include "hollywood.h"
+#include "gecko.h"
+#include "trace.h"
+#include "irq.h"
+#include "sdhc.h"
 #include <stdarg.h>
 
 #define PANIC_ON	200000
 #define PANIC_OFF	300000
 #define PANIC_INTER	1000000
 
+// Saving the log and trace goes through FatFs and the SDHC. That is only
+// safe from the main thread (system mode) with IRQs on and no PPC transfer
+// in flight: an exception or IPC IRQ may have cut into a FatFs update, and
+// the SDHC waits need its interrupt. Otherwise the data stays in the rings.
+static int _panic_can_save(void)
+{
+	u32 cpsr = get_cpsr();
+
+	if((cpsr & 0x1f) != 0x1f || (cpsr & CPSR_IRQDIS))
+		return 0;
+#ifdef CAN_HAZ_IRQ
+	if(sc_host.async_cmd != NULL)
+		return 0;
+#endif
+	return 1;
+}
+
 // figure out a use for mode...
 
 void panic2(int mode, ...)
@@ -25,6 +46,12 @@ void panic2(int mode, ...)
 	int arg;
 	va_list ap;
 
+	if(_panic_can_save()) {
+		gecko_log_flush();
+		gecko_log_close();
+		trace_save(TRACE_FILE);
+	}
+
 	clear32(HW_GPIO1OUT, HW_GPIO1_SENSE); // HW_GPIO1_SLOT
 	clear32(HW_GPIO1DIR, HW_GPIO1_SENSE);
 	clear32(HW_GPIO1OWNER, HW_GPIO1_SENSE);
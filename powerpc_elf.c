@@ -21,6 +21,9 @@ Copyright (C) 2009                      Andre Heider "dhewg" <dhewg@wiibrew.org>
 #include "memory.h"
 #include "string.h"
 #include "stubsb1.h"
+#include "lz4.h"
+#include "bootcache.h"
+#include "crypto.h"
 
 extern u8 __mem2_area_start[];
 
@@ -73,6 +76,157 @@ static int _check_physrange(u32 addr, u32 len) {
 static Elf32_Ehdr elfhdr;
 static Elf32_Phdr phdrs[PHDR_MAX];
 
+// PPC memory written through the ARM data cache since the last
+// _dirty_flush(), so a boot can clean exactly what it touched with a
+// single write buffer drain and AHB flush.
+// enough for a DOL's 18 sections and bss, or an ELF and the boot stubs
+#define DIRTY_MAX 20
+
+static struct {
+	u32 addr;
+	u32 len;
+} _dirty[DIRTY_MAX];
+static u32 _ndirty;
+
+static void _dirty_add(u32 addr, u32 len)
+{
+	if (_ndirty > 0 && _dirty[_ndirty-1].addr + _dirty[_ndirty-1].len == addr) {
+		_dirty[_ndirty-1].len += len;
+		return;
+	}
+	// out of slots: the last one grows to cover everything up to the new
+	// range, which is still far cheaper than cleaning the whole cache
+	if (_ndirty == DIRTY_MAX) {
+		u32 start = _dirty[DIRTY_MAX-1].addr;
+		u32 end = start + _dirty[DIRTY_MAX-1].len;
+		if (addr < start)
+			start = addr;
+		if (addr + len > end)
+			end = addr + len;
+		_dirty[DIRTY_MAX-1].addr = start;
+		_dirty[DIRTY_MAX-1].len = end - start;
+		return;
+	}
+	_dirty[_ndirty].addr = addr;
+	_dirty[_ndirty].len = len;
+	_ndirty++;
+}
+
+// dc_batch switches to a whole-cache clean by itself once the ranges add
+// up to more than the cache can hold
+static void _dirty_flush(void)
+{
+	dc_batch b;
+	u32 i;
+
+	dc_batch_begin(&b);
+	for (i = 0; i < _ndirty; i++)
+		dc_batch_flush(&b, (void *) _dirty[i].addr, _dirty[i].len);
+	dc_batch_end(&b);
+	_ndirty = 0;
+}
+
+#if _USE_FASTSEEK
+#define LINKMAP_SIZE 64
+
+static DWORD linkmap[LINKMAP_SIZE];
+
+// Map the file's cluster chain up front so the section seeks below don't
+// walk the FAT from the start every time. A heavily fragmented file that
+// doesn't fit in the table just falls back to normal seeking.
+static void _map_clusters(FIL *fd)
+{
+	linkmap[0] = LINKMAP_SIZE;
+	fd->cltbl = linkmap;
+	if (f_lseek(fd, CREATE_LINKMAP) != FR_OK)
+		fd->cltbl = 0;
+}
+#else
+#define _map_clusters(fd) do { } while (0)
+#endif
+
+// A payload file, raw or an LZ4 frame as told by its magic. Compressed
+// payloads are decompressed on the fly as they stream off the card, so
+// they can only be read front to back, which is the order the loaders
+// use anyway. A raw ELF found in the boot cache is read straight from
+// the sectors the cache lists, without FatFs.
+typedef struct {
+	FIL fd;
+	u8 lz4;
+	u8 cached;
+	u32 pos;
+	lz4_stream z;
+	char path[BOOTCACHE_PATH];	// the caller's may get loaded over
+} payload;
+
+static bootcache bcache MEM2_BSS ALIGNED(32);
+
+static int _payload_open(payload *p, const char *path)
+{
+	u8 magic[4];
+	u32 read;
+	FRESULT fres;
+
+	fres = f_open(&p->fd, path, FA_READ);
+	if (fres != FR_OK)
+		return -fres;
+	_map_clusters(&p->fd);
+
+	fres = f_read(&p->fd, magic, 4, &read);
+	if (fres != FR_OK)
+		return -fres;
+
+	p->lz4 = read == 4 && (magic[0] | (magic[1] << 8) | (magic[2] << 16) |
+						((u32)magic[3] << 24)) == LZ4_MAGIC;
+	if (p->lz4) {
+		gecko_printf("%s is LZ4 compressed\n", path);
+		return lz4_open(&p->z, &p->fd);
+	}
+
+	return -f_lseek(&p->fd, 0);
+}
+
+static int _payload_read(payload *p, void *dst, u32 len, u32 *read)
+{
+	if (p->cached) {
+		int res = bootcache_read(&bcache, p->pos, dst, len);
+		*read = res ? 0 : len;
+		p->pos += *read;
+		return res;
+	}
+	if (p->lz4)
+		return lz4_read(&p->z, dst, len, read);
+	return -f_read(&p->fd, dst, len, read);
+}
+
+static int _payload_seek(payload *p, u32 pos)
+{
+	if (p->cached) {
+		p->pos = pos;
+		return 0;
+	}
+	if (p->lz4)
+		return lz4_seek(&p->z, pos);
+	if (p->fd.fptr == pos)
+		return 0;
+	return -f_lseek(&p->fd, pos);
+}
+
+// memset32 for the word aligned bulk, bytewise for the ragged ends
+static void _zero(void *dst, u32 len)
+{
+	u8 *p = dst;
+	u32 head = (4 - ((u32)p & 3)) & 3;
+
+	if (head > len)
+		head = len;
+	memset(p, 0, head);
+	p += head;
+	len -= head;
+	memset32(p, 0, len);
+	memset(p + (len & ~3), 0, len & 3);
+}
+
 u32 virtualToPhysical(u32 virtualAddress)
 {
 	if ((virtualAddress & 0xC0000000) == 0xC0000000) return virtualAddress & ~0xC0000000;
@@ -473,80 +627,226 @@ void write_stub(u32 address, const u32 stub[], u32 size)
 		write32(address + 4 * i, stub[i]);
 }
 
+// one DOL section, or several that are contiguous both in the file and in
+// memory and so can be loaded with a single read
+typedef struct {
+	u32 offset;
+	u32 phys;
+	u32 size;
+} dol_run;
+
 int powerpc_load_dol(const char *path, u32 *entry)
 {
 	u32 read;
-	FIL fd;
-	FRESULT fres;
+	payload fd;
+	int fres;
 	dol_t dol_hdr;
-	gecko_printf("Loading DOL file: %s .\n", path);
-	fres = f_open(&fd, path, FA_READ);
-	if (fres != FR_OK)
-		return -fres;
-
-	fres = f_read(&fd, &dol_hdr, sizeof(dol_t), &read);
-	if (fres != FR_OK)
-		return -fres;
+	dol_run runs[7 + 11];
+	u32 nsections = 0, nruns = 0, total = 0;
+	u32 i, j;
+
+	_ndirty = 0;
+	fres = _payload_open(&fd, path);
+	if (fres)
+		return fres;
+
+	fres = _payload_read(&fd, &dol_hdr, sizeof(dol_t), &read);
+	if (fres)
+		return fres;
+	if (read != sizeof(dol_t))
+		return -100;
 
-	u32 end = 0;
-	int ii;
+	// go through the 7 text and 11 data sections in one loop, sorting
+	// them by file offset
+	for (i = 0; i < 7 + 11; i++) {
+		u32 offset = i < 7 ? dol_hdr.offsetText[i] : dol_hdr.offsetData[i-7];
+		u32 size = i < 7 ? dol_hdr.sizeText[i] : dol_hdr.sizeData[i-7];
+		u32 phys = virtualToPhysical(i < 7 ? dol_hdr.addressText[i] : dol_hdr.addressData[i-7]);
 
-	/* TEXT SECTIONS */
-	for (ii = 0; ii < 7; ii++)
-	{
-		if (!dol_hdr.sizeText[ii])
+		if (!size)
 			continue;
-		fres = f_lseek(&fd, dol_hdr.offsetText[ii]);
-		if (fres != FR_OK)
-			return -fres;
-		u32 phys = virtualToPhysical(dol_hdr.addressText[ii]);
-		fres = f_read(&fd, (void*)phys, dol_hdr.sizeText[ii], &read);
-		if (fres != FR_OK)
-			return -fres;
-		if (phys + dol_hdr.sizeText[ii] > end)
-			end = phys + dol_hdr.sizeText[ii];
-		gecko_printf("Text section of size %08x loaded from offset %08x to memory %08x.\n", dol_hdr.sizeText[ii], dol_hdr.offsetText[ii], phys);
-		gecko_printf("Memory area starts with %08x and ends with %08x (at address %08x)\n", read32(phys), read32((phys+(dol_hdr.sizeText[ii] - 1)) & ~3),(phys+(dol_hdr.sizeText[ii] - 1)) & ~3);
+		if (_check_physrange(phys, size) < 0) {
+			gecko_printf("DOL section %d out of bounds [0x%08x...0x%08x]\n",
+							i, phys, phys + size);
+			return -106;
+		}
+		for (j = nsections; j > 0 && runs[j-1].offset > offset; j--)
+			runs[j] = runs[j-1];
+		runs[j].offset = offset;
+		runs[j].phys = phys;
+		runs[j].size = size;
+		nsections++;
+		total += size;
 	}
 
-	/* DATA SECTIONS */
-	for (ii = 0; ii < 11; ii++)
-	{
-		if (!dol_hdr.sizeData[ii])
+	for (i = 0; i < nsections; i++) {
+		if (nruns > 0 &&
+				runs[nruns-1].offset + runs[nruns-1].size == runs[i].offset &&
+				runs[nruns-1].phys + runs[nruns-1].size == runs[i].phys) {
+			runs[nruns-1].size += runs[i].size;
 			continue;
-		fres = f_lseek(&fd, dol_hdr.offsetData[ii]);
-		if (fres != FR_OK)
-			return -fres;
-		u32 phys = virtualToPhysical(dol_hdr.addressData[ii]);
-		fres = f_read(&fd, (void*)phys, dol_hdr.sizeData[ii], &read);
-		if (fres != FR_OK)
-			return -fres;
-		if (phys + dol_hdr.sizeData[ii] > end)
-			end = phys + dol_hdr.sizeData[ii];
-		gecko_printf("Data section of size %08x loaded from offset %08x to memory %08x.\n", dol_hdr.sizeData[ii], dol_hdr.offsetData[ii], phys);
-		gecko_printf("Memory area starts with %08x and ends with %08x (at address %08x)\n", read32(phys), read32((phys+(dol_hdr.sizeData[ii] - 1)) & ~3),(phys+(dol_hdr.sizeData[ii] - 1)) & ~3);
+		}
+		runs[nruns++] = runs[i];
 	}
-  *entry = dol_hdr.entrypt;
+
+	u32 bss = virtualToPhysical(dol_hdr.addressBSS);
+	if (dol_hdr.sizeBSS) {
+		if (_check_physrange(bss, dol_hdr.sizeBSS) < 0) {
+			gecko_printf("DOL bss out of bounds [0x%08x...0x%08x]\n",
+							bss, bss + dol_hdr.sizeBSS);
+			return -106;
+		}
+		// before the sections, as linkers like to place small data
+		// sections inside the range the header gives for bss
+		_zero((void *) bss, dol_hdr.sizeBSS);
+		_dirty_add(bss, dol_hdr.sizeBSS);
+	}
+
+	for (i = 0; i < nruns; i++) {
+		fres = _payload_seek(&fd, runs[i].offset);
+		if (fres)
+			return fres;
+		fres = _payload_read(&fd, (void *) runs[i].phys, runs[i].size, &read);
+		if (fres)
+			return fres;
+		if (read != runs[i].size)
+			return -107;
+		_dirty_add(runs[i].phys, runs[i].size);
+	}
+
+	_dirty_flush();
+
+	gecko_printf("DOL %s: %u sections in %u reads, 0x%x bytes, bss 0x%08x [0x%x], entry 0x%08x\n",
+					path, nsections, nruns, total, bss, dol_hdr.sizeBSS, dol_hdr.entrypt);
+	*entry = dol_hdr.entrypt;
 	return 0;
 }
 
-int powerpc_load_elf(const char* path)
+static Elf32_Phdr *loads[PHDR_MAX];
+static u16 nloads;
+
+// Optional integrity check: if a manifest sits next to the payload (same
+// name, .sha extension) every PT_LOAD is hashed on the SHA-1 engine while
+// it loads and the boot is refused on a mismatch. The manifest holds one
+// SHA-1 of the segment's file bytes per program header, in header order.
+#define MANIFEST_MAGIC 0x53484131 // "SHA1"
+#define VERIFY_CHUNK 0x10000
+
+static struct {
+	u32 magic;
+	u32 count;
+	u8 hash[PHDR_MAX][20];
+} manifest;
+static u8 verify;
+
+static int _load_manifest(const char *path)
 {
-	u32 read;
+	char name[64];
+	char *p, *dot = NULL;
 	FIL fd;
+	u32 read;
 	FRESULT fres;
-	
-	fres = f_open(&fd, path, FA_READ);
-	if (fres != FR_OK)
-		return -fres;
 
-	fres = f_read(&fd, &elfhdr, sizeof(elfhdr), &read);
+	if ((u32)strlcpy(name, path, sizeof(name) - 4) >= sizeof(name) - 4)
+		return -1;
+	for (p = name; *p; p++) {
+		if (*p == '.')
+			dot = p;
+		else if (*p == '/')
+			dot = NULL;
+	}
+	if (dot)
+		*dot = 0;
+	strlcat(name, ".sha", sizeof(name));
 
+	fres = f_open(&fd, name, FA_READ);
 	if (fres != FR_OK)
-		return -fres;
+		return -1;
+	fres = f_read(&fd, &manifest, sizeof(manifest), &read);
+	f_close(&fd);
+	if (fres != FR_OK || read < 8 || manifest.magic != MANIFEST_MAGIC ||
+			manifest.count > PHDR_MAX || read < 8 + 20 * manifest.count) {
+		gecko_printf("%s: bad manifest\n", name);
+		return -108;
+	}
 
-	if (read != sizeof(elfhdr))
-		return -100;
+	gecko_printf("verifying against %s\n", name);
+	return 1;
+}
+
+// Reads a segment in VERIFY_CHUNK pieces and hands each one to the SHA-1
+// engine as soon as it is in memory, so the engine hashes chunk n while
+// chunk n+1 is read from the card.
+static int _read_verified(payload *fd, Elf32_Phdr *phdr, u8 *dst)
+{
+	sha_ctx sha;
+	u8 hash[20];
+	u32 done, len, read;
+	int fres;
+
+	sha_init(&sha);
+	for (done = 0; ; done += len) {
+		len = phdr->p_filesz - done;
+		if (len <= VERIFY_CHUNK)
+			break;
+		len = VERIFY_CHUNK;
+		fres = _payload_read(fd, dst + done, len, &read);
+		if (!fres && read != len)
+			fres = -107;
+		if (fres) {
+			sha_wait(&sha);
+			return fres;
+		}
+		sha_update_async(&sha, dst + done, len);
+	}
+
+	fres = _payload_read(fd, dst + done, len, &read);
+	if (!fres && read != len)
+		fres = -107;
+	if (fres) {
+		sha_wait(&sha);
+		return fres;
+	}
+	sha_final(&sha, dst + done, len, hash);
+
+	if (memcmp(hash, manifest.hash[phdr - phdrs], sizeof(hash))) {
+		gecko_printf("LOAD 0x%x: SHA-1 mismatch\n", phdr->p_offset);
+		return -108;
+	}
+	return 0;
+}
+
+// Reads and checks the ELF and program headers. Nothing is written to PPC
+// memory yet, so the PPC may keep running until this has succeeded.
+static int _open_elf(payload *fd, const char* path)
+{
+	u32 read;
+	int fres;
+
+	_ndirty = 0;
+	// too long to be cached; bootcache_record() would refuse it anyway
+	if ((u32)strlcpy(fd->path, path, sizeof(fd->path)) >= sizeof(fd->path))
+		fd->path[0] = 0;
+	fd->cached = !bootcache_lookup(&bcache, path);
+	if (fd->cached) {
+		gecko_printf("%s: boot cache hit\n", path);
+		fd->lz4 = 0;
+		fd->pos = 0;
+		memcpy(&elfhdr, &bcache.ehdr, sizeof(elfhdr));
+		memcpy(phdrs, bcache.phdrs, sizeof(phdrs));
+	} else {
+		fres = _payload_open(fd, path);
+		if (fres)
+			return fres;
+
+		fres = _payload_read(fd, &elfhdr, sizeof(elfhdr), &read);
+
+		if (fres)
+			return fres;
+
+		if (read != sizeof(elfhdr))
+			return -100;
+	}
 
 	if (memcmp("\x7F" "ELF\x01\x02\x01\x00\x00",elfhdr.e_ident,9)) {
 		gecko_printf("Invalid ELF header! 0x%02x 0x%02x 0x%02x 0x%02x\n",elfhdr.e_ident[0], elfhdr.e_ident[1], elfhdr.e_ident[2], elfhdr.e_ident[3]);
@@ -568,76 +868,202 @@ int powerpc_load_elf(const char* path)
 		return -104;
 	}
 
-	fres = f_lseek(&fd, elfhdr.e_phoff);
-	if (fres != FR_OK)
-		return -fres;
+	if (!fd->cached) {
+		fres = _payload_seek(fd, elfhdr.e_phoff);
+		if (fres)
+			return fres;
 
-	fres = f_read(&fd, phdrs, sizeof(phdrs[0])*elfhdr.e_phnum, &read);
-	if (fres != FR_OK)
-		return -fres;
+		fres = _payload_read(fd, phdrs, sizeof(phdrs[0])*elfhdr.e_phnum, &read);
+		if (fres)
+			return fres;
 
-	if (read != sizeof(phdrs[0])*elfhdr.e_phnum)
-		return -105;
+		if (read != sizeof(phdrs[0])*elfhdr.e_phnum)
+			return -105;
+	}
 
-	u16 count = elfhdr.e_phnum;
-	Elf32_Phdr *phdr = phdrs;
-	//powerpc_hang();
-	while (count--) {
+	fres = _load_manifest(path);
+	if (fres < 0 && fres != -1)
+		return fres;
+	verify = fres > 0;
+	if (verify && manifest.count != elfhdr.e_phnum) {
+		gecko_printf("manifest has %d hashes for %d PHDRs\n",
+						manifest.count, elfhdr.e_phnum);
+		return -108;
+	}
+
+	// Check every PT_LOAD before touching memory and sort them by file
+	// offset, so the file is read front to back in a single pass instead
+	// of seeking around in program header order.
+	Elf32_Phdr *phdr;
+	u16 i, j;
+
+	nloads = 0;
+	for (i = 0; i < elfhdr.e_phnum; i++) {
+		phdr = &phdrs[i];
 		if (phdr->p_type != PT_LOAD) {
 			gecko_printf("Skipping PHDR of type %d\n", phdr->p_type);
-		} else {
-			if (_check_physrange(phdr->p_paddr, phdr->p_memsz) < 0) {
-				gecko_printf("PHDR out of bounds [0x%08x...0x%08x]\n",
-								phdr->p_paddr, phdr->p_paddr + phdr->p_memsz);
-				return -106;
-			}
+			continue;
+		}
+		if (phdr->p_filesz > phdr->p_memsz ||
+				_check_physrange(phdr->p_paddr, phdr->p_memsz) < 0) {
+			gecko_printf("PHDR out of bounds [0x%08x...0x%08x]\n",
+							phdr->p_paddr, phdr->p_paddr + phdr->p_memsz);
+			return -106;
+		}
+		for (j = nloads; j > 0 && loads[j-1]->p_offset > phdr->p_offset; j--)
+			loads[j] = loads[j-1];
+		loads[j] = phdr;
+		nloads++;
+	}
 
-			void *dst = (void *) phdr->p_paddr;
+	return 0;
+}
 
-			gecko_printf("LOAD 0x%x @0x%08x [0x%x]\n", phdr->p_offset, phdr->p_paddr, phdr->p_filesz);
-			fres = f_lseek(&fd, phdr->p_offset);
-			if (fres != FR_OK)
-				return -fres;
-			fres = f_read(&fd, dst, phdr->p_filesz, &read);
-			if (fres != FR_OK)
-				return -fres;
+// streams the segments _open_elf() checked into memory and records what
+// it wrote with _dirty_add(), leaving the cache clean to the caller
+static int _load_segments(payload *fd)
+{
+	Elf32_Phdr *phdr;
+	u32 read;
+	int fres;
+	u16 i;
+
+	for (i = 0; i < nloads; i++) {
+		phdr = loads[i];
+		u8 *dst = (u8 *) phdr->p_paddr;
+
+		gecko_printf("LOAD 0x%x @0x%08x [0x%x/0x%x]\n", phdr->p_offset,
+						phdr->p_paddr, phdr->p_filesz, phdr->p_memsz);
+		fres = _payload_seek(fd, phdr->p_offset);
+		if (fres)
+			return fres;
+		if (verify) {
+			fres = _read_verified(fd, phdr, dst);
+			if (fres)
+				return fres;
+		} else {
+			// whole sectors (or whole LZ4 blocks) go straight into dst
+			fres = _payload_read(fd, dst, phdr->p_filesz, &read);
+			if (fres)
+				return fres;
 			if (read != phdr->p_filesz)
 				return -107;
 		}
-		phdr++;
+		_zero(dst + phdr->p_filesz, phdr->p_memsz - phdr->p_filesz);
+		_dirty_add(phdr->p_paddr, phdr->p_memsz);
 	}
 
-	dc_flushall();
-
 	gecko_printf("ELF load done. Entry point: %08x\n", elfhdr.e_entry);
 	//*entry = elfhdr.e_entry;
 	return 0;
 }
 
+// Fills bcache for a payload that just had to be loaded through FatFs and
+// returns 1 if it should be saved for the next boot. The segments may have
+// overwritten the caller's path by now, so this goes by the copy
+// _open_elf() took.
+static int _bootcache_record(payload *fd)
+{
+#if _USE_FASTSEEK
+	if (fd->cached || fd->lz4 || !fd->fd.cltbl || !fd->path[0])
+		return 0;
+	return !bootcache_record(&bcache, fd->path, &fd->fd, fd->fd.cltbl,
+								&elfhdr, phdrs);
+#else
+	return 0;
+#endif
+}
+
+int powerpc_load_elf(const char* path)
+{
+	payload fd;
+	int res;
+
+	res = _open_elf(&fd, path);
+	if (!res)
+		res = _load_segments(&fd);
+	_dirty_flush();
+	if (!res && _bootcache_record(&fd))
+		bootcache_save(&bcache);
+	return res;
+}
+
+// HW_TIMER ticks since start, in microseconds (the timer runs at ~1.9MHz)
+static u32 _us_since(u32 start)
+{
+	return (read32(HW_TIMER) - start) * 10 / 19;
+}
+
 
 int powerpc_boot_file(const char *path)
 {
+	payload fd;
 	int fres = 0; 
-	//FIL fd;
 	//u32 decryptionEndAddress, entry;
 	
-	gecko_printf("powerpc_load_elf returned %d .\n", fres = powerpc_load_elf(path));
+	fres = _open_elf(&fd, path);
 	//fres = powerpc_load_dol("/bootmii/00000003.app", &entry);
 	//decryptionEndAddress = ( 0x1330100 + read32(0x133008c + read32(0x1330008)) -1 ) & ~3; 
 	//gecko_printf("powerpc_load_dol returned %d .\n", fres);
-	if(fres) return fres;
+	if(fres) {
+		gecko_printf("powerpc_load_elf returned %d .\n", fres);
+		return fres;
+	}
 	gecko_printf("0xd8005A0 register value is %08x.\n", read32(0xd8005A0));
 	if((read32(0xd8005A0) & 0xFFFF0000) != 0xCAFE0000)
 	{	gecko_printf("Running old Wii code.\n");
+		fres = _load_segments(&fd);
+		_dirty_flush();
+		gecko_printf("powerpc_load_elf returned %d .\n", fres);
+		if(fres) return fres;
+		// the save needs the card to itself, so it happens before the
+		// PPC runs
+		if(_bootcache_record(&fd))
+			bootcache_save(&bcache);
 		powerpc_upload_oldstub(elfhdr.e_entry);
 		powerpc_reset();
 		gecko_printf("PPC booted!\n");
 		return 0;
 	}gecko_printf("Running Wii U code.\n");
+
+	// Load everything before touching the PPC: a read error must leave the
+	// old PPC code running, so the caller still gets the error and can
+	// fall back.
+	fres = _load_segments(&fd);
+	gecko_printf("powerpc_load_elf returned %d .\n", fres);
+	if(fres) {
+		_dirty_flush();
+		return fres;
+	}
+	// the save needs the card to itself, so it happens before the PPC runs
+	if(_bootcache_record(&fd))
+		bootcache_save(&bcache);
+
 	powerpc_upload_oldstub(0x1800);
  	write_stub(0x1800, (u32*)stubsb1, stubsb1_size/4);
-	powerpc_jump_stub(0x1800+stubsb1_size, elfhdr.e_entry);
-	dc_flushall();
+
+	// Jump to the entry point like powerpc_jump_stub, but set a flag right
+	// before the rfi: once it is set, stubsb1 is done with the Espresso and
+	// EXI can go back on. That is what the fixed 100ms delay used to guess
+	// at. The stub still runs untranslated, so the flag's physical address
+	// works as is.
+	u32 jump = 0x1800 + stubsb1_size;
+	u32 flag = jump + 11*4;
+	write32(jump + 4 * 0, 0x3c600000 | elfhdr.e_entry >> 16);		// lis r3, entry@h
+	write32(jump + 4 * 1, 0x60630000 | (elfhdr.e_entry & 0xffff));	// ori r3, r3, entry@l
+	write32(jump + 4 * 2, 0x7c7a03a6);								// mtsrr0 r3
+	write32(jump + 4 * 3, 0x3c600000 | flag >> 16);				// lis r3, flag@h
+	write32(jump + 4 * 4, 0x60630000 | (flag & 0xffff));			// ori r3, r3, flag@l
+	write32(jump + 4 * 5, 0x90630000);								// stw r3, 0(r3)
+	write32(jump + 4 * 6, 0x7c0018ac);								// dcbf 0, r3
+	write32(jump + 4 * 7, 0x7c0004ac);								// sync
+	write32(jump + 4 * 8, 0x38600000);								// li r3, 0
+	write32(jump + 4 * 9, 0x7c7b03a6);								// mtsrr1 r3
+	write32(jump + 4 * 10, 0x4c000064);							// rfi
+	write32(flag, 0);
+	// stubsb1, the jump to the entry point and the flag
+	_dirty_add(0x1800, flag + 4 - 0x1800);
+	_dirty_flush();
 	//this is where the end of our entry point loading stub will be
 	u32 oldValue = read32(0x1330108);
 
@@ -664,7 +1090,12 @@ int powerpc_boot_file(const char *path)
 	write32(0x1330104, 0x7c800124); // mtmsr r4
 	write32(0x1330108, 0x48001802); // b 0x1800
 	dc_flushrange((void*)0x1330100,32);
-	udelay(100000);
+
+	// give up waiting after the 100ms the old fixed delay allowed
+	u32 start = read32(HW_TIMER);
+	do
+	{	dc_invalidaterange((void*)flag,4);
+	}while(!read32(flag) && _us_since(start) < 100000);
 	set32(HW_EXICTRL, EXICTRL_ENABLE_EXI);
 	return fres;
 
@@ -712,6 +1143,7 @@ int powerpc_boot_mem(const u8 *addr, u32 len)
 
 	powerpc_hang();
 
+	_ndirty = 0;
 	while (count--) {
 		if (phdr->p_type != PT_LOAD) {
 			gecko_printf("Skipping PHDR of type %d\n", phdr->p_type);
@@ -725,11 +1157,12 @@ int powerpc_boot_mem(const u8 *addr, u32 len)
 			gecko_printf("LOAD 0x%x @0x%08x [0x%x]\n", phdr->p_offset, phdr->p_paddr, phdr->p_filesz);
 			memcpy((void *) phdr->p_paddr, &addr[phdr->p_offset],
 				phdr->p_filesz);
+			_dirty_add(phdr->p_paddr, phdr->p_filesz);
 		}
 		phdr++;
 	}
 
-	dc_flushall();
+	_dirty_flush();
 
 	gecko_printf("ELF load done, booting PPC...\n");
 	//powerpc_upload_oldstub(ehdr->e_entry);
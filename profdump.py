@@ -0,0 +1,85 @@
+#!/usr/bin/env python
+
+# Symbolizes a PC histogram fetched with IPC_SYS_GETPROFILE against the
+# unstripped armboot ELF it was taken from. Prints one "<samples> <function>"
+# line per function, most samples first, which hotorder.py turns into hot.ld.
+# A bucket is charged to the function its first byte belongs to, so with
+# 16 byte buckets a few samples may land on the neighbour of a tiny function.
+#
+# usage: profdump.py target/armboot-sym.elf profile.bin
+
+import sys, struct, bisect
+
+PROF_MAGIC = 0x50524f46
+SHT_SYMTAB = 2
+SHF_EXECINSTR = 4
+STT_NOTYPE = 0
+STT_FUNC = 2
+
+def load_symbols(elf):
+	if elf[:4] != "\x7fELF".encode("latin-1"):
+		print("ERROR: not an ELF file")
+		sys.exit(1)
+	shoff, = struct.unpack(">I", elf[0x20:0x24])
+	shentsize, shnum = struct.unpack(">HH", elf[0x2e:0x32])
+	sections = []
+	for i in range(shnum):
+		sections.append(struct.unpack(">IIIIIIIIII",
+			elf[shoff+i*shentsize:shoff+i*shentsize+40]))
+	syms = {}
+	for sh in sections:
+		if sh[1] != SHT_SYMTAB:
+			continue
+		strtab = sections[sh[6]]
+		strs = elf[strtab[4]:strtab[4]+strtab[5]]
+		for off in range(sh[4], sh[4] + sh[5], 16):
+			st_name, st_value, st_size, st_info, st_other, st_shndx = \
+				struct.unpack(">IIIBBH", elf[off:off+16])
+			if st_info & 0xf not in (STT_NOTYPE, STT_FUNC):
+				continue
+			if st_shndx == 0 or st_shndx >= len(sections):
+				continue
+			if not sections[st_shndx][2] & SHF_EXECINSTR:
+				continue
+			name = strs[st_name:strs.index(b"\x00", st_name)].decode("latin-1")
+			# skip ARM mapping symbols
+			if not name or name.startswith("$"):
+				continue
+			addr = st_value & ~1
+			if addr not in syms or st_info & 0xf == STT_FUNC:
+				syms[addr] = name
+	addrs = sorted(syms)
+	return addrs, [syms[a] for a in addrs]
+
+if len(sys.argv) != 3:
+	print("usage: %s armboot-sym.elf profile.bin" % sys.argv[0])
+	sys.exit(1)
+
+addrs, names = load_symbols(open(sys.argv[1], "rb").read())
+prof = open(sys.argv[2], "rb").read()
+
+magic, version, shift, base, buckets, samples, other, interval = \
+	struct.unpack(">IHHIIIII", prof[:28])
+if magic != PROF_MAGIC:
+	print("ERROR: not a profile dump")
+	sys.exit(1)
+if version != 1:
+	print("ERROR: unknown profile version %d" % version)
+	sys.exit(1)
+
+hist = struct.unpack(">%dI" % buckets, prof[28:28+buckets*4])
+
+funcs = {}
+for i, count in enumerate(hist):
+	if not count:
+		continue
+	addr = base + (i << shift)
+	j = bisect.bisect_right(addrs, addr) - 1
+	name = names[j] if j >= 0 else "0x%08x" % addr
+	funcs[name] = funcs.get(name, 0) + count
+
+print("# %d samples every %d ms, %d outside the histogram" % (samples, interval, other))
+for name, count in sorted(funcs.items(), key=lambda f: (-f[1], f[0])):
+	print("%d %s" % (count, name))
+if other:
+	print("%d <other>" % other)
@@ -0,0 +1,96 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	sampling profiler
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifdef CAN_HAZ_PROFILE
+
+#include "types.h"
+#include "irq.h"
+#include "string.h"
+#include "profile.h"
+
+static u32 prof_hist[PROF_BUCKETS] MEM2_BSS ALIGNED(32);
+static u32 prof_samples = 0;
+static u32 prof_other = 0;
+static u32 prof_interval = 0;
+static u32 prof_saved = 0;
+
+// Clears the histogram and speeds the timer alarm up to one sample every
+// ms milliseconds. The previous alarm rate comes back on profile_stop.
+void profile_start(u32 ms)
+{
+	u32 cookie;
+
+	if(!ms)
+		ms = 1;
+
+	cookie = irq_kill();
+	if(!prof_interval)
+		prof_saved = irq_get_alarm();
+	memset(prof_hist, 0, sizeof(prof_hist));
+	prof_samples = 0;
+	prof_other = 0;
+	prof_interval = ms;
+	irq_set_alarm(ms, 1);
+	irq_restore(cookie);
+}
+
+// stops sampling but keeps the histogram around for profile_copy
+void profile_stop(void)
+{
+	u32 cookie;
+
+	cookie = irq_kill();
+	if(prof_interval)
+		irq_set_alarm(prof_saved, prof_saved != 0);
+	prof_interval = 0;
+	irq_restore(cookie);
+}
+
+// called from the timer IRQ with the interrupted PC
+void profile_sample(u32 pc)
+{
+	if(!prof_interval)
+		return;
+
+	prof_samples++;
+	pc -= PROF_BASE;
+	if(pc < PROF_SIZE)
+		prof_hist[pc >> PROF_SHIFT]++;
+	else
+		prof_other++;
+}
+
+// copies a header and as many buckets as fit to buf and returns the
+// number of bytes used. Sampling may go on while this runs, so the total
+// can be a few samples off from the sum of the buckets.
+u32 profile_copy(void *buf, u32 size)
+{
+	prof_hdr *hdr = buf;
+	u32 count;
+
+	if(size < sizeof(prof_hdr))
+		return 0;
+
+	count = (size - sizeof(prof_hdr)) / sizeof(u32);
+	if(count > PROF_BUCKETS)
+		count = PROF_BUCKETS;
+
+	hdr->magic = PROF_MAGIC;
+	hdr->version = PROF_VERSION;
+	hdr->shift = PROF_SHIFT;
+	hdr->base = PROF_BASE;
+	hdr->buckets = count;
+	hdr->samples = prof_samples;
+	hdr->other = prof_other;
+	hdr->interval = prof_interval;
+	memcpy(hdr + 1, prof_hist, count * sizeof(u32));
+
+	return sizeof(prof_hdr) + count * sizeof(u32);
+}
+
+#endif
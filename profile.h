@@ -0,0 +1,64 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	sampling profiler
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "types.h"
+
+#define PROF_MAGIC		0x50524f46 // "PROF"
+#define PROF_VERSION	1
+
+// the histogram covers the sram region from mini.ld, where .text lives;
+// samples anywhere else (cold code in mem2, PPC stubs) count as "other"
+#define PROF_BASE		0xffff0000
+#define PROF_SIZE		0x10000
+#define PROF_SHIFT		4 // 16 byte buckets
+#define PROF_BUCKETS	(PROF_SIZE >> PROF_SHIFT)
+
+typedef struct {
+	u32 magic;
+	u16 version;
+	u16 shift;		// log2 of the bucket size
+	u32 base;		// address of the first bucket
+	u32 buckets;	// number of u32 counters following the header
+	u32 samples;	// total samples, including other
+	u32 other;		// samples outside base..base+(buckets<<shift)
+	u32 interval;	// sampling interval in ms
+} prof_hdr;
+
+#ifdef CAN_HAZ_PROFILE
+
+void profile_start(u32 ms);
+void profile_stop(void);
+void profile_sample(u32 pc);
+u32 profile_copy(void *buf, u32 size);
+
+#else
+
+// stub functions allow us to avoid sprinkling other code with ifdefs
+static inline void profile_start(u32 ms) {
+	(void)ms;
+}
+
+static inline void profile_stop(void) {
+}
+
+static inline void profile_sample(u32 pc) {
+	(void)pc;
+}
+
+static inline u32 profile_copy(void *buf, u32 size) {
+	(void)buf;
+	(void)size;
+	return 0;
+}
+
+#endif
+
+#endif
@@ -24,9 +24,11 @@
 #include "sdmmc.h"
 #include "sdhc.h"
 #include "gecko.h"
+#include "trace.h"
 #include "string.h"
 #include "memory.h"
 #include "utils.h"
+#include "hollywood.h"
 
 #ifdef CAN_HAZ_IRQ
 #include "irq.h"
@@ -43,6 +45,9 @@ struct sdhc_host sc_host;
 #define SDHC_COMMAND_TIMEOUT	500
 #define SDHC_TRANSFER_TIMEOUT	5000
 
+/* spin this long for a command to complete before sleeping in irq_wait */
+#define SDHC_SPIN_TICKS		(HW_TIMER_HZ / 10000)	/* 100us */
+
 #define sdhc_wait_intr(a,b,c) sdhc_wait_intr_debug(__func__, __LINE__, a, b, c)
 
 static inline u32 bus_space_read_4(bus_space_handle_t ioh, u32 reg)
@@ -99,6 +104,7 @@ static inline void bus_space_write_1(bus_space_handle_t ioh, u32 r, u8 v)
 
 /* flag values */
 #define SHF_USE_DMA		0x0001
+#define SHF_HIGH_SPEED		0x0002
 
 #define HREAD1(hp, reg)							\
 	(bus_space_read_1((hp)->ioh, (reg)))
@@ -129,6 +135,12 @@ int	sdhc_wait_intr_debug(const char *func, int line, struct sdhc_host *, int, in
 void	sdhc_transfer_data(struct sdhc_host *, struct sdmmc_command *);
 void	sdhc_read_data(struct sdhc_host *, u_char *, int);
 void	sdhc_write_data(struct sdhc_host *, u_char *, int);
+static void sdhc_read_response(struct sdhc_host *, struct sdmmc_command *);
+#ifdef CAN_HAZ_IRQ
+static void sdhc_async_intr(struct sdhc_host *, u_int16_t, u_int16_t);
+static void sdhc_async_finish(struct sdhc_host *, int);
+static void sdhc_async_expire(struct sdhc_host *);
+#endif
 //#define SDHC_DEBUG 1
 #ifdef SDHC_DEBUG
 int sdhcdebug = 0;
@@ -183,6 +195,9 @@ sdhc_host_found(bus_space_tag_t iot, bus_space_handle_t ioh, int usedma)
 	if (usedma && ISSET(caps, SDHC_DMA_SUPPORT))
 		SET(sc_host.flags, SHF_USE_DMA);
 
+	if (ISSET(caps, SDHC_HIGH_SPEED_SUPP))
+		SET(sc_host.flags, SHF_HIGH_SPEED);
+
 	/*
 	 * Determine the base clock frequency. (2.2.24)
 	 */
@@ -243,6 +258,12 @@ sdhc_host_reset(struct sdhc_host *hp)
 	/* Disable all interrupts. */
 	HWRITE2(hp, SDHC_NINTR_SIGNAL_EN, 0);
 
+#ifdef CAN_HAZ_IRQ
+	/* Whatever was in flight is lost; fail it so its owner gets a reply. */
+	if (hp->async_cmd != NULL)
+		sdhc_async_finish(hp, ENXIO);
+#endif
+
 	/*
 	 * Reset the entire host controller and wait up to 100ms for
 	 * the controller to clear the reset bit.
@@ -383,6 +404,43 @@ sdhc_bus_clock(struct sdhc_host *hp, int freq)
 	return 0;
 }
 
+/*
+ * Set the data bus width (1 or 4 bits) used by the host controller.
+ * The card must already have been switched with ACMD6.
+ */
+int
+sdhc_bus_width(struct sdhc_host *hp, int width)
+{
+	switch (width) {
+	case 1:
+		HCLR1(hp, SDHC_HOST_CTL, SDHC_4BIT_MODE);
+		break;
+	case 4:
+		HSET1(hp, SDHC_HOST_CTL, SDHC_4BIT_MODE);
+		break;
+	default:
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * Enable or disable high speed timing on the host controller side.
+ * Return EOPNOTSUPP if the controller cannot do high speed.
+ */
+int
+sdhc_bus_highspeed(struct sdhc_host *hp, int enable)
+{
+	if (!enable) {
+		HCLR1(hp, SDHC_HOST_CTL, SDHC_HIGH_SPEED);
+		return 0;
+	}
+	if (!ISSET(hp->flags, SHF_HIGH_SPEED))
+		return EOPNOTSUPP;
+	HSET1(hp, SDHC_HOST_CTL, SDHC_HIGH_SPEED);
+	return 0;
+}
+
 void
 sdhc_card_intr_mask(struct sdhc_host *hp, int enable)
 {
@@ -407,11 +465,11 @@ sdhc_wait_state(struct sdhc_host *hp, u_int32_t mask, u_int32_t value)
 	u_int32_t state;
 	int timeout;
 
-	for (timeout = 500; timeout > 0; timeout--) {
+	for (timeout = 50000; timeout > 0; timeout--) {
 		if (((state = HREAD4(hp, SDHC_PRESENT_STATE)) & mask)
 		    == value)
 			return 0;
-		udelay(10000);
+		udelay(100);
 	}
 	DPRINTF(0,("sdhc: timeout waiting for %x (state=%d)\n", value, state));
 	return ETIMEDOUT;
@@ -422,6 +480,10 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
 	int error;
 
+#ifdef CAN_HAZ_IRQ
+	sdhc_async_wait(hp);
+#endif
+
 	if (cmd->c_datalen > 0)
 		hp->data_command = 1;
 
@@ -453,7 +515,7 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 	int status = sdhc_wait_intr(hp, SDHC_COMMAND_COMPLETE, cmd->c_timeout);
 	if (!ISSET(status, SDHC_COMMAND_COMPLETE)) {
 		cmd->c_error = ETIMEDOUT;
-		gecko_printf("timeout dump: error_intr: 0x%x intr: 0x%x\n", hp->intr_error_status, hp->intr_status);
+		TRACE("timeout dump: error_intr: 0x%x intr: 0x%x\n", hp->intr_error_status, hp->intr_status);
 //		sdhc_dump_regs(hp);
 		SET(cmd->c_flags, SCF_ITSDONE);
 		hp->data_command = 0;
@@ -462,21 +524,8 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 
 //	gecko_printf("command_complete, continuing...\n");
 
-	/*
-	 * The host controller removes bits [0:7] from the response
-	 * data (CRC) and we pass the data up unchanged to the bus
-	 * driver (without padding).
-	 */
-	if (cmd->c_error == 0 && ISSET(cmd->c_flags, SCF_RSP_PRESENT)) {
-		if (ISSET(cmd->c_flags, SCF_RSP_136)) {
-			u_char *p = (u_char *)cmd->c_resp;
-			int i;
-
-			for (i = 0; i < 15; i++)
-				*p++ = HREAD1(hp, SDHC_RESPONSE + i);
-		} else
-			cmd->c_resp[0] = HREAD4(hp, SDHC_RESPONSE);
-	}
+	if (cmd->c_error == 0)
+		sdhc_read_response(hp, cmd);
 
 	/*
 	 * If the command has data to transfer in any direction,
@@ -491,6 +540,147 @@ sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 	hp->data_command = 0;
 }
 
+/*
+ * The host controller removes bits [0:7] from the response
+ * data (CRC) and we pass the data up unchanged to the bus
+ * driver (without padding).
+ */
+static void
+sdhc_read_response(struct sdhc_host *hp, struct sdmmc_command *cmd)
+{
+	if (!ISSET(cmd->c_flags, SCF_RSP_PRESENT))
+		return;
+
+	if (ISSET(cmd->c_flags, SCF_RSP_136)) {
+		u_char *p = (u_char *)cmd->c_resp;
+		int i;
+
+		for (i = 0; i < 15; i++)
+			*p++ = HREAD1(hp, SDHC_RESPONSE + i);
+	} else
+		cmd->c_resp[0] = HREAD4(hp, SDHC_RESPONSE);
+}
+
+#ifdef CAN_HAZ_IRQ
+/*
+ * Start a DMA data command and return as soon as it has been issued.
+ * The rest of the command (response, DMA boundary restarts, transfer
+ * completion) is driven from sdhc_intr(), which calls `done' in IRQ
+ * context once the command has finished or failed.
+ */
+int
+sdhc_start_async_command(struct sdhc_host *hp, struct sdmmc_command *cmd,
+    void (*done)(struct sdmmc_command *))
+{
+	int error;
+
+	if (!ISSET(hp->flags, SHF_USE_DMA) || cmd->c_datalen <= 0)
+		return EINVAL;
+
+	sdhc_async_wait(hp);
+
+	if (cmd->c_timeout == 0)
+		cmd->c_timeout = SDHC_TRANSFER_TIMEOUT;
+
+	hp->data_command = 1;
+	hp->intr_status = 0;
+	hp->async_done = done;
+	hp->async_start = read32(HW_TIMER);
+	hp->async_cmd = cmd;
+
+	error = sdhc_start_command(hp, cmd);
+	if (error != 0) {
+		hp->async_cmd = NULL;
+		hp->data_command = 0;
+		cmd->c_error = error;
+		SET(cmd->c_flags, SCF_ITSDONE);
+	}
+	return error;
+}
+
+/*
+ * Sleep until the asynchronous command in flight (if any) is done.  The
+ * periodic alarm wakes us up, so a lost interrupt ends in a timeout.
+ */
+void
+sdhc_async_wait(struct sdhc_host *hp)
+{
+	while (hp->async_cmd != NULL) {
+		u32 cookie = irq_kill();
+		sdhc_async_expire(hp);
+		if (hp->async_cmd != NULL)
+			irq_wait();
+		irq_restore(cookie);
+	}
+}
+
+/*
+ * Called from the periodic alarm, so that a command whose completion
+ * interrupt never comes still gets its callback even if nobody waits.
+ */
+void
+sdhc_async_timeout(void)
+{
+	sdhc_async_expire(&sc_host);
+}
+
+/* Must be called with IRQs disabled or from IRQ context. */
+static void
+sdhc_async_expire(struct sdhc_host *hp)
+{
+	struct sdmmc_command *cmd = hp->async_cmd;
+
+	if (cmd == NULL || read32(HW_TIMER) - hp->async_start <
+	    (u32)HW_TIMER_MS2TICKS(cmd->c_timeout))
+		return;
+
+	gecko_printf("sdhc: async command %d timed out\n", cmd->c_opcode);
+	(void)sdhc_soft_reset(hp, SDHC_RESET_DAT|SDHC_RESET_CMD);
+	sdhc_async_finish(hp, ETIMEDOUT);
+}
+
+static void
+sdhc_async_finish(struct sdhc_host *hp, int error)
+{
+	struct sdmmc_command *cmd = hp->async_cmd;
+
+	if (error != 0)
+		cmd->c_error = error;
+	SET(cmd->c_flags, SCF_ITSDONE);
+
+	hp->async_cmd = NULL;
+	hp->data_command = 0;
+	hp->intr_status = 0;
+	hp->async_done(cmd);
+}
+
+static void
+sdhc_async_intr(struct sdhc_host *hp, u_int16_t status, u_int16_t error)
+{
+	struct sdmmc_command *cmd = hp->async_cmd;
+
+	if (ISSET(status, SDHC_ERROR_INTERRUPT)) {
+		sdhc_async_finish(hp, ISSET(error, SDHC_CMD_TIMEOUT_ERROR|
+		    SDHC_DATA_TIMEOUT_ERROR) ? ETIMEDOUT : EIO);
+		return;
+	}
+
+	if (ISSET(status, SDHC_COMMAND_COMPLETE))
+		sdhc_read_response(hp, cmd);
+
+	if (ISSET(status, SDHC_TRANSFER_COMPLETE)) {
+		if (ISSET(cmd->c_flags, SCF_CMD_READ))
+			ahb_flush_from(AHB_SDHC);
+		sdhc_async_finish(hp, 0);
+		return;
+	}
+
+	/* DMA stopped at a buffer boundary; see sdhc_transfer_data(). */
+	if (ISSET(status, SDHC_DMA_INTERRUPT))
+		HWRITE4(hp, SDHC_DMA_ADDR, HREAD4(hp, SDHC_DMA_ADDR));
+}
+#endif
+
 int
 sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 {
@@ -586,7 +776,11 @@ sdhc_start_command(struct sdhc_host *hp, struct sdmmc_command *cmd)
 	 * Start a CPU data transfer.  Writing to the high order byte
 	 * of the SDHC_COMMAND register triggers the SD command. (1.5)
 	 */
-	HWRITE2(hp, SDHC_BLOCK_SIZE, blksize | 7<<12);
+	/*
+	 * Use the largest DMA buffer boundary so that the controller
+	 * stops for SDHC_DMA_INTERRUPT as rarely as possible.
+	 */
+	HWRITE2(hp, SDHC_BLOCK_SIZE, blksize | SDHC_DMA_BOUNDARY_512K);
 	if (blkcount > 0)
 		HWRITE2(hp, SDHC_BLOCK_COUNT, blkcount);
 	HWRITE4(hp, SDHC_ARGUMENT, cmd->c_arg);
@@ -663,12 +857,18 @@ sdhc_soft_reset(struct sdhc_host *hp, int mask)
 
 	DPRINTF(1,("sdhc: software reset reg=%#x\n", mask));
 
+	/*
+	 * Poll every 10us; the reset normally finishes within a few of
+	 * those.  Keep clearing the register every 10ms like we always
+	 * did in case the bits don't clear by themselves.
+	 */
 	HWRITE1(hp, SDHC_SOFTWARE_RESET, mask);
-	for (timo = 10; timo > 0; timo--) {
+	for (timo = 10000; timo > 0; timo--) {
 		if (!ISSET(HREAD1(hp, SDHC_SOFTWARE_RESET), mask))
 			break;
-		udelay(10000);
-		HWRITE1(hp, SDHC_SOFTWARE_RESET, 0);
+		udelay(10);
+		if (timo % 1000 == 1)
+			HWRITE1(hp, SDHC_SOFTWARE_RESET, 0);
 	}
 	if (timo == 0) {
 		DPRINTF(1,("sdhc: timeout reg=%#x\n", HREAD1(hp, SDHC_SOFTWARE_RESET)));
@@ -685,13 +885,21 @@ sdhc_wait_intr_debug(const char *funcname, int line, struct sdhc_host *hp, int m
 	(void) line;
 
 	int status;
+	u32 start, elapsed;
 
 	mask |= SDHC_ERROR_INTERRUPT;
 	mask |= SDHC_ERROR_TIMEOUT;
 
 	status = hp->intr_status & mask;
 
-	for (; timo > 0; timo--) {
+	/*
+	 * Short commands usually complete within a few microseconds, so
+	 * spin on the status for a bit; after that sleep until the next
+	 * interrupt.  Either the SDHC IRQ or the periodic alarm wakes us
+	 * up, so the timeout is still checked regularly.
+	 */
+	start = read32(HW_TIMER);
+	for (;;) {
 #ifndef CAN_HAZ_IRQ
 		sdhc_irq(); // seems backwards but ok
 #endif
@@ -699,7 +907,21 @@ sdhc_wait_intr_debug(const char *funcname, int line, struct sdhc_host *hp, int m
 			status = hp->intr_status & mask;
 			break;
 		}
-		udelay(1000);
+
+		elapsed = read32(HW_TIMER) - start;
+		if (elapsed >= (u32)HW_TIMER_MS2TICKS(timo)) {
+			timo = 0;
+			break;
+		}
+
+#ifdef CAN_HAZ_IRQ
+		if (elapsed >= SDHC_SPIN_TICKS) {
+			u32 cookie = irq_kill();
+			if (hp->intr_status == 0)
+				irq_wait();
+			irq_restore(cookie);
+		}
+#endif
 	}
 
 	if (timo == 0) {
@@ -740,6 +962,7 @@ int
 sdhc_intr(void)
 {
 	u_int16_t status;
+	u_int16_t error = 0;
 
 	DPRINTF(1,("shdc_intr():\n"));
 //	sdhc_dump_regs(&sc_host);
@@ -757,7 +980,6 @@ sdhc_intr(void)
 
 	/* Service error interrupts. */
 	if (ISSET(status, SDHC_ERROR_INTERRUPT)) {
-		u_int16_t error;
 		u_int16_t signal;
 
 		/* Acknowledge error interrupts. */
@@ -802,6 +1024,13 @@ sdhc_intr(void)
 		sc_host.intr_status |= status;
 	}
 
+#ifdef CAN_HAZ_IRQ
+	/* Nobody is polling for an asynchronous command; finish it here. */
+	if (sc_host.async_cmd != NULL && ISSET(status, SDHC_ERROR_INTERRUPT|
+	    SDHC_COMMAND_COMPLETE|SDHC_TRANSFER_COMPLETE|SDHC_DMA_INTERRUPT))
+		sdhc_async_intr(&sc_host, status, error);
+#endif
+
 	/* Service SD card interrupts. */
 	if  (ISSET(status, SDHC_CARD_INTERRUPT)) {
 		DPRINTF(0,("sdhc: card interrupt\n"));
@@ -837,8 +1066,6 @@ sdhc_dump_regs(struct sdhc_host *hp)
 }
 #endif
 
-#include "hollywood.h"
-
 void sdhc_irq(void)
 {
 	sdhc_intr();
@@ -35,6 +35,9 @@ struct sdhc_host {
 	u_int16_t intr_status;		/* soft interrupt status */
 	u_int16_t intr_error_status;	/* soft error status */
 	int data_command;
+	struct sdmmc_command *async_cmd;	/* data command in flight */
+	void (*async_done)(struct sdmmc_command *);
+	u32 async_start;		/* HW_TIMER when it was issued */
 };
 
 extern struct sdhc_host sc_host;
@@ -54,6 +57,8 @@ void	sdhc_ipc(volatile ipc_request *req);
 /* Host standard register set */
 #define SDHC_DMA_ADDR			0x00
 #define SDHC_BLOCK_SIZE			0x04
+#define SDHC_DMA_BOUNDARY_SHIFT	12
+#define SDHC_DMA_BOUNDARY_512K		(7<<SDHC_DMA_BOUNDARY_SHIFT) /* largest */
 #define SDHC_BLOCK_COUNT		0x06
 #define SDHC_BLOCK_COUNT_MAX		512
 #define SDHC_ARGUMENT			0x08
@@ -203,8 +208,16 @@ int	sdhc_host_reset(struct sdhc_host *hp);
 int	sdhc_card_detect(struct sdhc_host *hp);
 int	sdhc_bus_power(struct sdhc_host *hp, u_int32_t);
 int	sdhc_bus_clock(struct sdhc_host *hp, int);
+int	sdhc_bus_width(struct sdhc_host *hp, int);
+int	sdhc_bus_highspeed(struct sdhc_host *hp, int);
 void	sdhc_card_intr_mask(struct sdhc_host *hp, int);
 void	sdhc_card_intr_ack(struct sdhc_host *hp);
 void	sdhc_exec_command(struct sdhc_host *hp, struct sdmmc_command *);
+#ifdef CAN_HAZ_IRQ
+int	sdhc_start_async_command(struct sdhc_host *hp, struct sdmmc_command *,
+	    void (*)(struct sdmmc_command *));
+void	sdhc_async_wait(struct sdhc_host *hp);
+void	sdhc_async_timeout(void);
+#endif
 
 #endif
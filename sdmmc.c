@@ -14,6 +14,8 @@ Copyright (C) 2008, 2009	Sven Peter <svenpeter@gmail.com>
 #include "string.h"
 #include "utils.h"
 #include "memory.h"
+#include "diskio.h"
+#include "ff.h"
 
 //#define SDMMC_DEBUG
 
@@ -43,6 +45,14 @@ static struct sdmmc_card card;
 static struct sdmmc_card card MEM2_BSS;
 #endif
 
+// bumped on every card change; unlike new_card the PPC can't clear it
+static u32 card_generation;
+
+// DMA target for the SCR and SWITCH_FUNC status blocks
+static u8 sd_reg_buf[SD_SWITCH_FUNC_LEN] MEM2_BSS ALIGNED(32);
+
+static void sdmmc_setup_bus(void);
+
 void sdmmc_attach(sdmmc_chipset_handle_t handle)
 {
 	memset(&card, 0, sizeof(card));
@@ -78,6 +88,7 @@ void sdmmc_needs_discover(void)
 	DPRINTF(0, ("sdmmc: card needs discovery.\n"));
 	sdhc_host_reset(card.handle);
 	card.new_card = 1;
+	card_generation++;
 
 	if (!sdhc_card_detect(card.handle)) {
 		DPRINTF(1, ("sdmmc: card (no longer?) inserted.\n"));
@@ -253,6 +264,8 @@ void sdmmc_needs_discover(void)
 		card.inserted = card.selected = 0;
 		goto out_clock;
 	}
+
+	sdmmc_setup_bus();
 	return;
 
 out_clock:
@@ -288,6 +301,107 @@ int sdmmc_select(void)
 	return 0;
 }
 
+static int sdmmc_app_cmd(struct sdmmc_command *cmd)
+{
+	struct sdmmc_command acmd;
+
+	memset(&acmd, 0, sizeof(acmd));
+	acmd.c_opcode = MMC_APP_CMD;
+	acmd.c_arg = ((u32)card.rca)<<16;
+	acmd.c_flags = SCF_RSP_R1;
+	sdhc_exec_command(card.handle, &acmd);
+	if (acmd.c_error) {
+		cmd->c_error = acmd.c_error;
+		return -1;
+	}
+
+	sdhc_exec_command(card.handle, cmd);
+	return cmd->c_error ? -1 : 0;
+}
+
+static int sdmmc_switch_func(u32 mode)
+{
+	struct sdmmc_command cmd;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.c_opcode = SD_SWITCH_FUNC;
+	cmd.c_arg = SD_SWITCH_ARG(mode, SD_ACCESS_MODE_HIGH_SPEED);
+	cmd.c_data = sd_reg_buf;
+	cmd.c_datalen = SD_SWITCH_FUNC_LEN;
+	cmd.c_blklen = SD_SWITCH_FUNC_LEN;
+	cmd.c_flags = SCF_RSP_R1 | SCF_CMD_ADTC | SCF_CMD_READ;
+	sdhc_exec_command(card.handle, &cmd);
+	if (cmd.c_error) {
+		gecko_printf("sdmmc: SD_SWITCH_FUNC failed with %d\n", cmd.c_error);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read the SCR and move the card to a 4-bit bus and high speed timing
+ * when both the card and the host controller support it.  Failures
+ * are not fatal; the card just stays at 1 bit and/or 25MHz.
+ */
+static void sdmmc_setup_bus(void)
+{
+	struct sdmmc_command cmd;
+	u8 scr[SD_SCR_LEN];
+
+	DPRINTF(2, ("sdmmc: SD_APP_SEND_SCR\n"));
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.c_opcode = SD_APP_SEND_SCR;
+	cmd.c_data = sd_reg_buf;
+	cmd.c_datalen = SD_SCR_LEN;
+	cmd.c_blklen = SD_SCR_LEN;
+	cmd.c_flags = SCF_RSP_R1 | SCF_CMD_ADTC | SCF_CMD_READ;
+	if (sdmmc_app_cmd(&cmd) < 0) {
+		gecko_printf("sdmmc: SD_APP_SEND_SCR failed with %d\n", cmd.c_error);
+		return;
+	}
+	memcpy(scr, sd_reg_buf, SD_SCR_LEN);
+	gecko_printf("sdmmc: scr: sd_spec=%d bus_widths=%x\n",
+		SD_SCR_SD_SPEC(scr), SD_SCR_BUS_WIDTHS(scr));
+
+	if (SD_SCR_BUS_WIDTHS(scr) & SD_SCR_BUS_WIDTH_4) {
+		DPRINTF(2, ("sdmmc: SD_APP_SET_BUS_WIDTH\n"));
+		memset(&cmd, 0, sizeof(cmd));
+		cmd.c_opcode = SD_APP_SET_BUS_WIDTH;
+		cmd.c_arg = SD_ARG_BUS_WIDTH_4;
+		cmd.c_flags = SCF_RSP_R1;
+		if (sdmmc_app_cmd(&cmd) < 0)
+			gecko_printf("sdmmc: SD_APP_SET_BUS_WIDTH failed with %d\n", cmd.c_error);
+		else
+			sdhc_bus_width(card.handle, 4);
+	}
+
+	// CMD6 only exists since SD 1.10
+	if (SD_SCR_SD_SPEC(scr) < SD_SCR_SD_SPEC_1_10)
+		return;
+
+	if (sdmmc_switch_func(SD_SWITCH_MODE_CHECK) < 0)
+		return;
+	if (!(SD_SWITCH_GRP1_SUPPORT(sd_reg_buf) & (1<<SD_ACCESS_MODE_HIGH_SPEED)))
+		return;
+
+	if (sdmmc_switch_func(SD_SWITCH_MODE_SET) < 0)
+		return;
+	if (SD_SWITCH_GRP1_RESULT(sd_reg_buf) != SD_ACCESS_MODE_HIGH_SPEED) {
+		gecko_printf("sdmmc: card refused to switch to high speed\n");
+		return;
+	}
+
+	// a high speed card still works at 25MHz if the host can't keep up
+	if (sdhc_bus_highspeed(card.handle, 1) != 0)
+		return;
+	if (sdhc_bus_clock(card.handle, SDMMC_SDCLK_50MHZ) != 0) {
+		sdhc_bus_highspeed(card.handle, 0);
+		sdhc_bus_clock(card.handle, SDMMC_DEFAULT_CLOCK);
+		return;
+	}
+	gecko_printf("sdmmc: running in high speed mode\n");
+}
+
 int sdmmc_check_card(void)
 {
 	if (card.inserted == 0)
@@ -309,19 +423,26 @@ int sdmmc_ack_card(void)
 	return -1;
 }
 
-int sdmmc_read(u32 blk_start, u32 blk_count, void *data)
+u32 sdmmc_card_generation(void)
 {
-	struct sdmmc_command cmd;
+	return card_generation;
+}
 
-//	gecko_printf("%s(%u, %u, %p)\n", __FUNCTION__, blk_start, blk_count, data);
+/*
+ * Check that the card can take a data command, selecting it if needed.
+ * Selecting sends a synchronous command, so this must not run from the
+ * SDHC interrupt.
+ */
+static int sdmmc_check_rw(void)
+{
 	if (card.inserted == 0) {
-		gecko_printf("sdmmc: READ: no card inserted.\n");
+		gecko_printf("sdmmc: no card inserted.\n");
 		return -1;
 	}
 
 	if (card.selected == 0) {
 		if (sdmmc_select() < 0) {
-			gecko_printf("sdmmc: READ: cannot select card.\n");
+			gecko_printf("sdmmc: cannot select card.\n");
 			return -1;
 		}
 	}
@@ -331,70 +452,75 @@ int sdmmc_read(u32 blk_start, u32 blk_count, void *data)
 		return -1;
 	}
 
-	DPRINTF(2, ("sdmmc: MMC_READ_BLOCK_MULTIPLE\n"));
-	memset(&cmd, 0, sizeof(cmd));
-	cmd.c_opcode = MMC_READ_BLOCK_MULTIPLE;
+	return 0;
+}
+
+/*
+ * Fill in `cmd' for a multi-block read or write of `blk_count' sectors
+ * starting at `blk_start'. `blk_count' must not exceed
+ * SDHC_BLOCK_COUNT_MAX. Safe from IRQ context.
+ */
+static void sdmmc_setup_rw(struct sdmmc_command *cmd, int opcode, u32 blk_start,
+		u32 blk_count, void *data)
+{
+	memset(cmd, 0, sizeof(*cmd));
+	cmd->c_opcode = opcode;
 	if (card.sdhc_blockmode)
-		cmd.c_arg = blk_start;
+		cmd->c_arg = blk_start;
 	else
-		cmd.c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_data = data;
-	cmd.c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_flags = SCF_RSP_R1 | SCF_CMD_READ;
-	sdhc_exec_command(card.handle, &cmd);
-
-	if (cmd.c_error) {
-		gecko_printf("sdmmc: MMC_READ_BLOCK_MULTIPLE failed with %d\n", cmd.c_error);
-		return -1;
-	}
-	DPRINTF(2, ("sdmmc: MMC_READ_BLOCK_MULTIPLE done\n"));
-
-	return 0;
+		cmd->c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
+	cmd->c_data = data;
+	cmd->c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
+	cmd->c_blklen = SDMMC_DEFAULT_BLOCKLEN;
+	cmd->c_flags = SCF_RSP_R1;
+	if (opcode == MMC_READ_BLOCK_MULTIPLE)
+		cmd->c_flags |= SCF_CMD_READ;
 }
 
-#ifndef LOADER
-int sdmmc_write(u32 blk_start, u32 blk_count, void *data)
+/*
+ * Transfer any number of blocks, split into the largest commands the
+ * host controller accepts.
+ */
+static int sdmmc_rw(int opcode, u32 blk_start, u32 blk_count, void *data)
 {
 	struct sdmmc_command cmd;
+	u32 count;
 
-	if (card.inserted == 0) {
-		gecko_printf("sdmmc: READ: no card inserted.\n");
+	if (sdmmc_check_rw() < 0)
 		return -1;
-	}
 
-	if (card.selected == 0) {
-		if (sdmmc_select() < 0) {
-			gecko_printf("sdmmc: READ: cannot select card.\n");
+	while (blk_count > 0) {
+		count = MIN(blk_count, SDHC_BLOCK_COUNT_MAX);
+		sdmmc_setup_rw(&cmd, opcode, blk_start, count, data);
+
+		sdhc_exec_command(card.handle, &cmd);
+
+		if (cmd.c_error) {
+			gecko_printf("sdmmc: CMD%d of %u blocks at %u failed with %d\n",
+					opcode, count, blk_start, cmd.c_error);
 			return -1;
 		}
-	}
 
-	if (card.new_card == 1) {
-		gecko_printf("sdmmc: new card inserted but not acknowledged yet.\n");
-		return -1;
+		blk_start += count;
+		blk_count -= count;
+		data = (u8 *)data + count * SDMMC_DEFAULT_BLOCKLEN;
 	}
 
-	DPRINTF(2, ("sdmmc: MMC_WRITE_BLOCK_MULTIPLE\n"));
-	memset(&cmd, 0, sizeof(cmd));
-	cmd.c_opcode = MMC_WRITE_BLOCK_MULTIPLE;
-	if (card.sdhc_blockmode)
-		cmd.c_arg = blk_start;
-	else
-		cmd.c_arg = blk_start * SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_data = data;
-	cmd.c_datalen = blk_count * SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_blklen = SDMMC_DEFAULT_BLOCKLEN;
-	cmd.c_flags = SCF_RSP_R1;
-	sdhc_exec_command(card.handle, &cmd);
+	return 0;
+}
 
-	if (cmd.c_error) {
-		gecko_printf("sdmmc: MMC_READ_BLOCK_MULTIPLE failed with %d\n", cmd.c_error);
-		return -1;
-	}
-	DPRINTF(2, ("sdmmc: MMC_WRITE_BLOCK_MULTIPLE done\n"));
+int sdmmc_read(u32 blk_start, u32 blk_count, void *data)
+{
+//	gecko_printf("%s(%u, %u, %p)\n", __FUNCTION__, blk_start, blk_count, data);
+	DPRINTF(2, ("sdmmc: MMC_READ_BLOCK_MULTIPLE\n"));
+	return sdmmc_rw(MMC_READ_BLOCK_MULTIPLE, blk_start, blk_count, data);
+}
 
-	return 0;
+#ifndef LOADER
+int sdmmc_write(u32 blk_start, u32 blk_count, void *data)
+{
+	DPRINTF(2, ("sdmmc: MMC_WRITE_BLOCK_MULTIPLE\n"));
+	return sdmmc_rw(MMC_WRITE_BLOCK_MULTIPLE, blk_start, blk_count, data);
 }
 
 int sdmmc_get_sectors(void)
@@ -416,25 +542,113 @@ int sdmmc_get_sectors(void)
 #endif
 
 #ifdef CAN_HAZ_IPC
+// SD reads and writes from the PPC are started here and completed from
+// the SDHC interrupt, so the slow queue keeps moving while DMA runs.
+// Requests larger than SDHC_BLOCK_COUNT_MAX are chained from the interrupt.
+static ipc_request current_request;
+static struct sdmmc_command current_cmd;
+static u32 current_blk, current_left;
+
+static int sdmmc_ipc_next(void);
+
+static void sdmmc_ipc_done(struct sdmmc_command *cmd)
+{
+	int code, tag;
+
+	if (!cmd->c_error && current_left > 0 && sdmmc_ipc_next() == 0)
+		return;
+
+	if (current_request.req == IPC_SDMMC_READ)
+		dc_flushrange((void *)current_request.args[2],
+				current_request.args[1]*SDMMC_DEFAULT_BLOCKLEN);
+
+	code = current_request.code;
+	tag = current_request.tag;
+	current_request.code = 0;
+	ipc_post(code, tag, 1, (cmd->c_error || current_left > 0) ? -1 : 0);
+}
+
+static int sdmmc_ipc_next(void)
+{
+	int opcode;
+	u32 count, done;
+
+	if (current_request.req == IPC_SDMMC_READ)
+		opcode = MMC_READ_BLOCK_MULTIPLE;
+	else
+		opcode = MMC_WRITE_BLOCK_MULTIPLE;
+
+	// pulled or deselected since sdmmc_ipc_start: fail rather than select
+	if (card.inserted == 0 || card.selected == 0)
+		return -1;
+
+	count = MIN(current_left, SDHC_BLOCK_COUNT_MAX);
+	done = current_request.args[1] - current_left;
+	sdmmc_setup_rw(&current_cmd, opcode, current_blk, count,
+			(u8 *)current_request.args[2] + done * SDMMC_DEFAULT_BLOCKLEN);
+	if (sdhc_start_async_command(card.handle, &current_cmd, sdmmc_ipc_done) != 0)
+		return -1;
+
+	current_blk += count;
+	current_left -= count;
+	return 0;
+}
+
+// The PPC goes straight to the card, around mini's FatFs and sector
+// cache: get dirty sectors in the range onto the card and drop them, and
+// after a write make mini mount the volume again before it next uses it.
+static void sdmmc_ipc_forget(volatile ipc_request *req)
+{
+	DWORD range[2];
+
+	if (req->req == IPC_SDMMC_WRITE) {
+		gecko_log_close();
+		f_forget(0);
+	}
+	range[0] = req->args[0];
+	range[1] = req->args[1];
+	disk_ioctl(0, CTRL_FORGET, range);
+}
+
+static int sdmmc_ipc_start(volatile ipc_request *req)
+{
+	sdmmc_ipc_forget(req);
+	current_request = *req;
+	current_blk = req->args[0];
+	current_left = req->args[1];
+	// the card is selected here, so chaining from the IRQ never has to
+	if (current_left == 0 || sdmmc_check_rw() < 0 || sdmmc_ipc_next() < 0) {
+		current_request.code = 0;
+		return -1;
+	}
+	return 0;
+}
+
 void sdmmc_ipc(volatile ipc_request *req)
 {
 	int ret;
+
+	if (current_request.code != 0 &&
+			(req->req == IPC_SDMMC_READ || req->req == IPC_SDMMC_WRITE)) {
+		gecko_printf("sdmmc: previous IPC request is not done yet.\n");
+		ipc_post(req->code, req->tag, 1, -1);
+		return;
+	}
+
 	switch (req->req) {
 	case IPC_SDMMC_ACK:
 		ret = sdmmc_ack_card();
 		ipc_post(req->code, req->tag, 1, ret);
 		break;
 	case IPC_SDMMC_READ:
-		ret = sdmmc_read(req->args[0], req->args[1], (void *)req->args[2]);
-		dc_flushrange((void *)req->args[2],
-				req->args[1]*SDMMC_DEFAULT_BLOCKLEN);
-		ipc_post(req->code, req->tag, 1, ret);
+		if (sdmmc_ipc_start(req) < 0)
+			ipc_post(req->code, req->tag, 1, -1);
 		break;
 	case IPC_SDMMC_WRITE:
 		dc_invalidaterange((void *)req->args[2],
 				req->args[1]*SDMMC_DEFAULT_BLOCKLEN);
-		ret = sdmmc_write(req->args[0],	req->args[1], (void *)req->args[2]);
-		ipc_post(req->code, req->tag, 1, ret);
+		if (sdmmc_ipc_start(req) < 0)
+			ipc_post(req->code, req->tag, 1, -1);
 		break;
 	case IPC_SDMMC_STATE:
 		ipc_post(req->code, req->tag, 1,
@@ -21,6 +21,7 @@ typedef struct sdhc_host * sdmmc_chipset_handle_t;
 #define SDMMC_SDCLK_OFF		0
 #define SDMMC_SDCLK_400KHZ	400
 #define SDMMC_SDCLK_25MHZ	25000
+#define SDMMC_SDCLK_50MHZ	50000
 
 struct sdmmc_csd {
 	int	csdver;		/* CSD structure format */
@@ -161,6 +162,7 @@ void sdmmc_needs_discover(void);
 int sdmmc_select(void);
 int sdmmc_check_card(void);
 int sdmmc_ack_card(void);
+u32 sdmmc_card_generation(void);
 int sdmmc_read(u32 blk_start, u32 blk_count, void *data);
 #ifdef CAN_HAZ_IPC
 void sdmmc_ipc(volatile ipc_request *req);
@@ -189,11 +191,13 @@ int sdmmc_get_sectors(void);
 
 /* SD commands */				/* response type */
 #define SD_SEND_RELATIVE_ADDR		3	/* R6 */
+#define SD_SWITCH_FUNC			6	/* R1 */
 #define SD_SEND_IF_COND			8	/* R7 */
 
 /* SD application commands */			/* response type */
 #define SD_APP_SET_BUS_WIDTH		6	/* R1 */
 #define SD_APP_OP_COND			41	/* R3 */
+#define SD_APP_SEND_SCR			51	/* R1 */
 
 /* OCR bits */
 #define MMC_OCR_MEM_READY		(1<<31)	/* memory power-up status bit */
@@ -238,6 +242,23 @@ int sdmmc_get_sectors(void);
 #define SD_ARG_BUS_WIDTH_1		0
 #define SD_ARG_BUS_WIDTH_4		2
 
+/* SCR register, as the 8 bytes read by SD_APP_SEND_SCR (MSB first) */
+#define SD_SCR_LEN			8
+#define SD_SCR_SD_SPEC(scr)		((scr)[0] & 0x0f)
+#define  SD_SCR_SD_SPEC_1_10		1	/* CMD6 supported */
+#define SD_SCR_BUS_WIDTHS(scr)		((scr)[1] & 0x0f)
+#define  SD_SCR_BUS_WIDTH_1		(1<<0)
+#define  SD_SCR_BUS_WIDTH_4		(1<<2)
+
+/* SD_SWITCH_FUNC argument and 64-byte status (function group 1 only) */
+#define SD_SWITCH_FUNC_LEN		64
+#define SD_SWITCH_MODE_CHECK		(0U<<31)
+#define SD_SWITCH_MODE_SET		(1U<<31)
+#define SD_SWITCH_ARG(mode, fn)		((mode) | 0x00fffff0 | (fn))
+#define SD_ACCESS_MODE_HIGH_SPEED	1
+#define SD_SWITCH_GRP1_SUPPORT(st)	((st)[13])
+#define SD_SWITCH_GRP1_RESULT(st)	((st)[16] & 0x0f)
+
 /* MMC R2 response (CSD) */
 #define MMC_CSD_CSDVER(resp)		MMC_RSP_BITS((resp), 126, 2)
 #define  MMC_CSD_CSDVER_1_0		1
@@ -0,0 +1,107 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	binary trace ring
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifdef CAN_HAZ_TRACE
+
+#include "types.h"
+#include "irq.h"
+#include "utils.h"
+#include "hollywood.h"
+#include "string.h"
+#include "ff.h"
+#include "trace.h"
+#include <stdarg.h>
+
+static trace_rec trace_ring[TRACE_RECORDS] MEM2_BSS ALIGNED(32);
+static u32 trace_seq = 0;
+
+// Safe from IRQ context. Only claiming the slot needs IRQs off; the record
+// is filled afterwards, and its seq is stored last so a reader can tell a
+// record that was overwritten while it was being copied.
+void trace_record(const char *fmt, u32 nargs, ...)
+{
+	trace_rec *rec;
+	va_list ap;
+	u32 cookie, seq, i;
+
+	cookie = irq_kill();
+	seq = trace_seq++;
+	irq_restore(cookie);
+
+	rec = &trace_ring[seq & (TRACE_RECORDS-1)];
+	rec->seq = 0;
+	rec->fmt = fmt;
+	rec->time = read32(HW_TIMER);
+	if(nargs > TRACE_ARGS_MAX)
+		nargs = TRACE_ARGS_MAX;
+	va_start(ap, nargs);
+	for(i = 0; i < nargs; i++)
+		rec->args[i] = va_arg(ap, u32);
+	va_end(ap);
+	// +1 so that even the very first record never reads as 0
+	rec->seq = ((seq + 1) << 3) | nargs;
+}
+
+// copies a header and the recorded events, oldest first, to buf and
+// returns the number of bytes used
+u32 trace_copy(void *buf, u32 size)
+{
+	trace_hdr *hdr = buf;
+	trace_rec *out;
+	u32 first, count, i;
+
+	if(size < sizeof(trace_hdr))
+		return 0;
+
+	count = trace_seq;
+	first = 0;
+	if(count > TRACE_RECORDS) {
+		first = count - TRACE_RECORDS;
+		count = TRACE_RECORDS;
+	}
+	if(count > (size - sizeof(trace_hdr)) / sizeof(trace_rec)) {
+		first += count - (size - sizeof(trace_hdr)) / sizeof(trace_rec);
+		count = (size - sizeof(trace_hdr)) / sizeof(trace_rec);
+	}
+
+	hdr->magic = TRACE_MAGIC;
+	hdr->version = TRACE_VERSION;
+	hdr->rec_size = sizeof(trace_rec);
+	hdr->count = count;
+	hdr->first = first;
+	hdr->timer_hz = HW_TIMER_HZ;
+
+	out = (trace_rec *)(hdr + 1);
+	for(i = 0; i < count; i++)
+		memcpy(&out[i], &trace_ring[(first + i) & (TRACE_RECORDS-1)], sizeof(trace_rec));
+
+	return sizeof(trace_hdr) + count * sizeof(trace_rec);
+}
+
+int trace_save(const char *path)
+{
+	static u8 buf[sizeof(trace_hdr) + TRACE_RECORDS * sizeof(trace_rec)] MEM2_BSS ALIGNED(32);
+	FIL fd;
+	FRESULT fres;
+	u32 len, written;
+
+	len = trace_copy(buf, sizeof(buf));
+
+	fres = f_open(&fd, path, FA_CREATE_ALWAYS|FA_WRITE);
+	if(fres != FR_OK)
+		return -fres;
+	fres = f_write(&fd, buf, len, &written);
+	f_close(&fd);
+	if(fres != FR_OK)
+		return -fres;
+	if(written != len)
+		return -100;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,72 @@
+/*
+	mini - a Free Software replacement for the Nintendo/BroadOn IOS.
+	binary trace ring
+
+# This code is licensed to you under the terms of the GNU GPL, version 2;
+# see file COPYING or http://www.gnu.org/licenses/old-licenses/gpl-2.0.txt
+*/
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "types.h"
+
+#define TRACE_FILE		"/bootmii/trace.bin"
+#define TRACE_MAGIC		0x54524345 // "TRCE"
+#define TRACE_VERSION	2
+
+#define TRACE_ARGS_MAX	4
+#define TRACE_RECORDS	1024 // must be a power of two
+
+// one trace event; the format string is not copied, only its address in
+// the armboot image, so it is formatted later by tracedump.py. Formats
+// may only use integer conversions since every argument is stored as u32.
+typedef struct {
+	const char *fmt;
+	u32 time;		// HW_TIMER
+	u32 seq;		// ((sequence number + 1) << 3) | argument count, written
+					// last; 0 while the record is being written
+	u32 args[TRACE_ARGS_MAX];
+	u32 pad;
+} trace_rec;
+
+typedef struct {
+	u32 magic;
+	u16 version;
+	u16 rec_size;
+	u32 count;
+	u32 first;		// sequence number of the first record
+	u32 timer_hz;
+} trace_hdr;
+
+#ifdef CAN_HAZ_TRACE
+
+void trace_record(const char *fmt, u32 nargs, ...);
+u32 trace_copy(void *buf, u32 size);
+int trace_save(const char *path);
+
+#define _TRACE_N(_0, _1, _2, _3, _4, n, ...) n
+#define _TRACE_NARGS(...) _TRACE_N(_, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+
+#define TRACE(fmt, ...) \
+	trace_record(fmt, _TRACE_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+#else
+
+// stub functions allow us to avoid sprinkling other code with ifdefs
+static inline u32 trace_copy(void *buf, u32 size) {
+	(void)buf;
+	(void)size;
+	return 0;
+}
+
+static inline int trace_save(const char *path) {
+	(void)path;
+	return 0;
+}
+
+#define TRACE(...) do { } while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+
+# Decodes a trace dump written by trace_save() or fetched with
+# IPC_SYS_GETTRACE. The records only hold format string addresses, so the
+# unstripped armboot ELF the dump came from is needed to resolve them.
+#
+# usage: tracedump.py target/armboot-sym.elf trace.bin
+
+import sys, re, struct
+
+PT_LOAD = 1
+
+def load_segments(elf):
+	if elf[:4] != "\x7fELF".encode("latin-1"):
+		print("ERROR: not an ELF file")
+		sys.exit(1)
+	phoff, = struct.unpack(">I", elf[0x1c:0x20])
+	phentsize, phnum = struct.unpack(">HH", elf[0x2a:0x2e])
+	segs = []
+	for i in range(phnum):
+		p_type, p_offset, p_vaddr, p_paddr, p_filesz = \
+			struct.unpack(">IIIII", elf[phoff+i*phentsize:phoff+i*phentsize+20])
+		if p_type == PT_LOAD and p_filesz:
+			segs.append((p_vaddr, p_offset, p_filesz))
+	return segs
+
+def read_string(elf, segs, addr):
+	for vaddr, offset, size in segs:
+		if vaddr <= addr < vaddr + size:
+			start = offset + addr - vaddr
+			end = elf.index(b"\x00", start)
+			return elf[start:end].decode("latin-1")
+	return None
+
+conv = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(hh|h|ll|l|z)?([diouxXpcs%])")
+
+def format_record(elf, segs, fmt, args):
+	args = list(args)
+	def sub(m):
+		flags, width, prec, length, c = m.groups()
+		if c == "%":
+			return "%"
+		v = args.pop(0) if args else 0
+		spec = "%" + flags + width + ("." + prec if prec else "")
+		if c in "di":
+			if v & 0x80000000:
+				v -= 0x100000000
+			return (spec + "d") % v
+		if c == "p":
+			return (spec + "s") % ("0x%08x" % v)
+		if c == "c":
+			return (spec + "c") % chr(v & 0xff)
+		if c == "s":
+			s = read_string(elf, segs, v)
+			if s is None:
+				s = "<0x%08x>" % v
+			return (spec + "s") % s
+		return (spec + c) % v
+	return conv.sub(sub, fmt)
+
+elf = open(sys.argv[1], "rb").read()
+dump = open(sys.argv[2], "rb").read()
+segs = load_segments(elf)
+
+magic, version, rec_size, count, first, timer_hz = struct.unpack(">IHHIII", dump[:20])
+if magic != 0x54524345 or version != 2:
+	print("ERROR: not a version 2 trace dump")
+	sys.exit(1)
+
+pos = 20
+t0 = None
+for i in range(count):
+	fmt, time, seq = struct.unpack(">III", dump[pos:pos+12])
+	args = struct.unpack(">IIII", dump[pos+12:pos+28])
+	pos += rec_size
+	if (seq >> 3) != ((first + i + 1) & 0x1fffffff):
+		print("[torn record %d]" % (first + i))
+		continue
+	if t0 is None:
+		t0 = time
+	ms = ((time - t0) & 0xffffffff) * 1000.0 / timer_hz
+	text = read_string(elf, segs, fmt)
+	if text is None:
+		text = "<unknown format 0x%08x>\n" % fmt
+	sys.stdout.write("[%10.3f] %s" % (ms, format_record(elf, segs, text, args[:seq & 7])))
+	if not text.endswith("\n"):
+		sys.stdout.write("\n")
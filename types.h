@@ -43,6 +43,9 @@ typedef s32 size_t;
 #define MEM2_DATA __attribute__ ((section (".data.mem2")))
 #define MEM2_RODATA __attribute__ ((section (".rodata.mem2")))
 #define ALIGNED(x) __attribute__((aligned(x)))
+// init/shutdown/panic paths: GCC puts these in .text.unlikely, which
+// mini.ld links apart from the hot code (see COLD_REGION in the Makefile)
+#define COLD __attribute__((cold))
 
 #define STACK_ALIGN(type, name, cnt, alignment)         \
 	u8 _al__##name[((sizeof(type)*(cnt)) + (alignment) + \